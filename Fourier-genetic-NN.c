@@ -5,420 +5,371 @@
 // * bunch of genes encode a network
 // * each gene = DFT of weights, serialized as a long vector
 
+// Genotype ↔ phenotype:
+// * the phenotype of a candidate is the weight vector of the whole network (n weights)
+// * its gene is the real DFT of that vector, n/2 + 1 complex coefficients, scaled by 1/n
+//   so that the inverse DFT gives back the weights
+// * cross-over and mutation work on the coefficients;  a cross-over point splits the
+//   spectrum into the low frequencies of 1 parent and the high frequencies of the other
+// * every generation, all the genes are decoded by 1 batched inverse DFT over the whole
+//   population (fftw_plan_many_dft_c2r), with a plan that is made once per run
+
+// FFTW plans are made with FFTW_MEASURE, which is slow the 1st time;  the wisdom it
+// gathers is saved to WisdomFile, so later runs plan almost instantly.
+
+// The candidates are initialized, evaluated, selected and reproduced on the thread pool of
+// genetic-NN.c (setThreads, runJob).  As there, every random choice about a candidate is
+// made with its own generator, seeded by (seed, generation, index), so the results do not
+// depend on the number of threads.
+
 // TO-DO:
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>			// memcpy
 #include <math.h>
 #include <assert.h>
-#include <time.h>			// time as random seed in create_NN()
+#include <time.h>			// clock_gettime
 #include <stdbool.h>
+#include <unistd.h>			// sysconf
 #include <fftw3.h>			// fastest Fourier Transform in the West
+#include "genetic-NN.h"		// thread pool:  setThreads, runJob
 // #include "feedforward-NN.h"
 
-#define Eta 0.01			// learning rate
 #define BIASOUTPUT 1.0		// output for bias. It's always 1.
 
 #define numLayers		4
-#define neuronsPerLayer	[4, 3, 3, 2]
+#define MaxWidth		10
 #define populationSize	100
 #define MaxGens			100
 #define CrossRate		0.98
-#define MutationRate	(1.0 / N)
-
-double fitness[populationSize];
+#define MutationRate	(1.0 / numCoeffs)
+#define MutationSize	0.05	// a mutated coefficient moves by up to ± this much
+#define NumTrials		100		// samples per generation
+#define WisdomFile		"fftw.wisdom"
 
 // Sorry I have to use global variables to simplify code
 // =============================================================
+static int neuronsPerLayer[numLayers] = {10, 10, 10, 10};
 
-// A question is how to store the current network as well as the entire population.
-// Perhaps the data structure should store all the "population rows".
-double population[L][M][N];		// each element is a connection weight
-double output[L][M];			// output of each neuron
-double grad[L][M];				// local gradient for each neuron
-double score[L][M];				// fitness of each neuron
+static int numWeights;			// n = weights per network = length of the DFT
+static int numCoeffs;			// n/2 + 1 complex coefficients per gene
+static int weightStride;		// row lengths of the population arrays, padded so that
+static int geneStride;			// every row has the same alignment as the 1st one
 
-double best[L][N][N];			// best candidate
-double selected[L][M][N];		// selected from binary tournament
-double children[L][M][N];		// 2nd generation
+// The population, allocated once per run with fftw_malloc (aligned for SIMD)
+static double *weights;			// phenotypes:  populationSize × weightStride
+static fftw_complex *genome;	// genotypes:  populationSize × geneStride
+static fftw_complex *selected;	// selected from binary tournament
+static fftw_complex *children;	// 2nd generation
+static double fitness[populationSize];
 
-int neuronsPerLayer[L] = { N };		// initialize all layers to have N neurons
-int dimK = N;						// dimension of input-layer vector
+static fftw_plan decodeMany;	// genome → weights, the whole population at once
+static fftw_plan decodeOne;		// 1 gene → 1 weight vector, used with fftw_execute_dft_c2r
+static fftw_plan encodeMany;	// weights → genome
 
-extern int rand(void);
-extern void qsort(void *, size_t, size_t, int (*comparator)(const void *, const void*));
-extern void forward_gNN(int, double []);		// forward-propagate the gNN
-extern void backprop_gNN(double []);
+static bool batchedFFT = true;	// decode with decodeMany, or candidate by candidate
 
-double fitness(int layer, int index)
-// Call forward-prop with input-output pairs to evaluate the current network.
-	{
-	// initialize network
-	double K[dimK];
-	double errors[dimK];
+static double samples[NumTrials][MaxWidth];		// K
+static double targets[NumTrials][MaxWidth];		// K* = transition(K)
 
-	// forward_prop
-	#define NumTrials	100
-	double sum_fitness = 0.0;
-	for (int i = 0; i < NumTrials; ++i)
-		{
-		// prepare input and ideal output values
-		// Create random K vector (4 + 2 + 2 elements)
-		for (int k = 0; k < 4; ++k)
-			K[k] = floor((rand() / (double) RAND_MAX) * 10.0) / 10.0;
-		for (int k = 4; k < 6; ++k)
-			K[k] = (rand() / (double) RAND_MAX) > 0.5 ? 1.0 : 0.0;
-		for (int k = 6; k < 8; ++k)
-			K[k] = floor((rand() / (double) RAND_MAX) * 10.0) / 10.0;
-
-		// Desired value = K_star
-		double K_star[10];
-		extern void transition(double [], double []);
-		transition(K, K_star);
-
-		forward_gNN(dimK, K);		// forward-propagate the gNN
+static unsigned runSeed;
+static int currentGen;
+static unsigned rngState[populationSize];	// each candidate's own random numbers, for 1 generation
 
-		// Calculate the error, for back-prop
-		for (int k = 0; k < dimK; ++k)
-			errors[k] = K_star[k] - K[k];	// error = ideal - actual
+extern double sigmoid(double);
+extern void transition(double [], double []);
 
-		// Use back-prop to calculate local gradients
-		backprop_gNN(errors);
-		// Then fitness = sum of local gradients for a neuron, relative to 1 example.
-		double fitness = 0.0;
-		for (int n = 0; n < N; ++n)
-			{
-			double g = grad[layer][n];
-			fitness += g * g;
-			}
-		// And we need to add up the fitnesses for all examples.
-		sum_fitness -= fitness;
-		}
+static double now()
+	{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
 	}
 
-// This seems to be independent of gene expression
-// INPUT: population
-// OUTPUT: selected = the winner (an individual = a neuron)
-void binaryTournament(int layer, int candidate)
+// **** Buffers and plans, once per run
+// Planning with FFTW_MEASURE overwrites the arrays, so it must come before the population
+// is initialized.
+static void createPlans()
 	{
-	// Choose 2 candidates (neurons) in the population
-	int i = (rand() / (double) RAND_MAX) * M;
-	int j = (rand() / (double) RAND_MAX) * M;
-
-	double *p1 = population[layer][i], *p2 = population[layer][j];
-
-	double *p;
-	if (fitness(layer, i) > fitness(layer, j))
-		p = p1;
-	else
-		p = p2;
-
-	for (int n = 0; n < N; ++n)
-		selected[layer][candidate][n] = p[n];
+	numWeights = 0;
+	for (int l = 1; l < numLayers; ++l)
+		numWeights += neuronsPerLayer[l] * (neuronsPerLayer[l - 1] + 1);
+	numCoeffs = numWeights / 2 + 1;
+	weightStride = (numWeights + 3) & ~3;		// multiples of 32 bytes
+	geneStride = (numCoeffs + 1) & ~1;
+
+	weights = fftw_alloc_real((size_t) populationSize * weightStride);
+	genome = fftw_alloc_complex((size_t) populationSize * geneStride);
+	selected = fftw_alloc_complex((size_t) populationSize * geneStride);
+	children = fftw_alloc_complex((size_t) populationSize * geneStride);
+
+	bool wisdom = fftw_import_wisdom_from_filename(WisdomFile);
+	double start = now();
+	int n = numWeights;
+	decodeMany = fftw_plan_many_dft_c2r(1, &n, populationSize,
+		genome, NULL, 1, geneStride, weights, NULL, 1, weightStride,
+		FFTW_MEASURE | FFTW_PRESERVE_INPUT);
+	decodeOne = fftw_plan_dft_c2r_1d(n, genome, weights, FFTW_MEASURE | FFTW_PRESERVE_INPUT);
+	encodeMany = fftw_plan_many_dft_r2c(1, &n, populationSize,
+		weights, NULL, 1, weightStride, genome, NULL, 1, geneStride, FFTW_MEASURE);
+	printf("FFTW plans for n = %d made in %.1f ms (%s)\n", n, (now() - start) * 1000.0,
+		wisdom ? "with saved wisdom" : "no saved wisdom");
+	fftw_export_wisdom_to_filename(WisdomFile);
 	}
 
-// Each neuron is an individual, a point mutation mutates a single weight within the neuron
-void pointMutation(double *dna, double rate)
+static void destroyPlans()
 	{
-	for (int n = 0; n < N; ++n)
-		if ((rand() / (double) RAND_MAX) < rate)
-			dna[n] = (dna[n] == '0') ? '1' : '0';
+	fftw_destroy_plan(decodeMany);
+	fftw_destroy_plan(decodeOne);
+	fftw_destroy_plan(encodeMany);
+	fftw_free(weights);
+	fftw_free(genome);
+	fftw_free(selected);
+	fftw_free(children);
 	}
 
-// Cross-over of 2 neurons
-void crossOver(double *result, double *parent1, double *parent2, double rate)
+// **** Genotype → phenotype, for the whole population
+static void decodePopulation()
 	{
-	if ((rand() / (double) RAND_MAX) > rate)
-		{
-		for (int n = 0; n < N; ++n)
-			result[n] = parent1[n];
-		return;
-		}
-
-	int point = (rand() / (double) RAND_MAX) * N;
-	int n;
-	for (n = 0; n < point; ++n)
-		result[n] = parent1[n];
-	for (; n < N; ++n)
-		result[n] = parent2[n];
+	if (batchedFFT)
+		fftw_execute(decodeMany);
+	else
+		for (int m = 0; m < populationSize; ++m)
+			fftw_execute_dft_c2r(decodeOne, genome + m * geneStride, weights + m * weightStride);
 	}
 
-// **** Reproduce for 1 generation
-void reproduce(int layer, int popSize, double crossRate, double mutationRate)
+// **** Random numbers, as candidateSeed() in genetic-NN.c
+static unsigned geneSeed(int generation, int index)
 	{
-	double *p1, *p2;
-
-	for (int m = 0; m < M; ++m)
-		{
-		p1 = selected[layer][m];
-		p2 = (m % 2 == 0) ? selected[layer][m + 1] : selected[layer][m - 1];
-		if (m == M - 1)
-			p2 = selected[layer][0];
-
-		crossOver(children[layer][m], p1, p2, crossRate);
-		pointMutation(children[layer][m], mutationRate);
-		}
+	// "splitmix" hash of the 3 numbers
+	unsigned long long z = runSeed + 0x9E3779B97F4A7C15ULL *
+		((unsigned long long) generation * (populationSize + 1) + index + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (unsigned) (z ^ (z >> 31));
 	}
 
-void printCandidate(double candidate[N])
+static inline double uniform(unsigned *state)
 	{
-	for (int n = 0; n < N; ++n)
-		printf("%c", (candidate[n] == '0') ? ' ' : '*');
-	printf("\n");
+	return rand_r(state) / (double) RAND_MAX;
 	}
 
-void FourierTransform(int n, double *network, fftw_complex *gene)
+// Draw a new set of samples, shared by all the candidates of a generation
+static void drawFourierSamples(int generation)
 	{
-    fftw_plan p;
+	unsigned state = geneSeed(generation, -1);
+	for (int i = 0; i < NumTrials; ++i)
+		{
+		double *K = samples[i];
+		// Create random K vector (4 + 2 + 2 elements)
+		for (int k = 0; k < 4; ++k)
+			K[k] = floor(uniform(&state) * 10.0) / 10.0;
+		for (int k = 4; k < 6; ++k)
+			K[k] = uniform(&state) > 0.5 ? 1.0 : 0.0;
+		for (int k = 6; k < 8; ++k)
+			K[k] = floor(uniform(&state) * 10.0) / 10.0;
+		for (int k = 8; k < MaxWidth; ++k)
+			K[k] = 0.0;
 
-	p = fftw_plan_dft_r2c_1d(n, network, gene);
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+		// Desired value = K_star
+		transition(K, targets[i]);
+		}
 	}
 
-// Main algorithm for genetic search
-void evolve()
+// Forward-prop with the weight vector w:  for each layer, for each neuron, the bias weight
+// and then 1 weight per input
+static void forward_fNN(const double *w, double *V, double *output)
 	{
-	// **** initialize population
+	double input[MaxWidth];
+	for (int k = 0; k < neuronsPerLayer[0]; ++k)
+		output[k] = V[k];
 
-	// find total # of neurons per NN
-	int numNeurons = 0;
-	for (int l = 0; l < numLayers; ++l)						// for each layer
-		numNeurons += neuronsPerLayer[l];
-
-	// allocate space for one NN
-	double *candidate = malloc(numNeurons * sizeof(double));
-	// allocate space for entire genome
-	fftw_complex genome[populationSize][] = fftw_malloc(sizeof(fftw_complex) * numNeurons * populationSize);
-
-	// generate population of NNs with random weights
-	for (int m = 0; m < populationSize; ++m)				// for each population candidate
+	for (int l = 1; l < numLayers; l++)
 		{
-		for (int i = 0, l = 0; l < numLayers; ++l)			// for each layer
-			for (int n = 0; n < neuronsPerLayer[l]; ++n)	// for each neuron
-				{
-				++i;
-				candidate[i] = (rand() / (double) RAND_MAX) * 2.0 - 1.0;	// w ∊ [-1,1]
-				}
-		// do Fourier transform
-		FourierTransform(numNeurons, candidate, genome[m]);
+		int numInputs = neuronsPerLayer[l - 1];
+		memcpy(input, output, numInputs * sizeof (double));
+		for (int n = 0; n < neuronsPerLayer[l]; n++)
+			{
+			double v = *w++ * BIASOUTPUT;		// induced local field for neurons
+			for (int k = 0; k < numInputs; k++)
+				v += *w++ * input[k];
+			output[n] = sigmoid(v);
+			}
 		}
+	}
 
-	// Compare fitness of 2 candidates
-	int compareFitness(const void *l, const void *r)
-		{
-		int x_index = *(const int *)l;
-		int y_index = *(const int *)r;
-		return (fitness(x_index) < fitness(y_index));
-		};
-
-	for (int m = 0; m < populationSize; ++m)		// for each candidate
-		fitness[m] = evaluateCandidate(genome[m]);
-
-	// Sort population according to fitness
-	qsort(genome, populationSize, numNeurons * sizeof(fftw_complex), compareFitness);
-
-	printf("Initial population:\n");
-	for (int m = 0; m < populationSize; ++m)
-		printCandidate(genome[m]);
-
-	for (int i = 0; i < MaxGens; ++i)
+// Fitness = - mean square error on the samples
+static double evaluateCandidate(const double *w)
+	{
+	double output[MaxWidth];
+	double sumOfSquareError = 0.0;
+	int numOutputs = neuronsPerLayer[numLayers - 1];
+	for (int i = 0; i < NumTrials; ++i)
 		{
-		printf("gen %03d: \n", i);
-
-		for (int m = 0; m < populationSize; ++m)	// for the size of 1 population
-			binaryTournament();
-
-		qsort(selected, populationSize, numNeurons * sizeof(fftw_complex), compareFitness);
-
-		reproduce(l, M, CrossRate, MutationRate);
-
-		qsort(children[l], M, N, compareFitness);
-
-		for (int m = 0; m < populationSize; ++m)
-			printCandidate(genome[m]);
-
-		strncpy(population, children, sizeof(population));
-
-		if (fitness(best, 0) >= N)
+		forward_fNN(w, samples[i], output);
+		for (int k = 0; k < numOutputs; ++k)
 			{
-			printf("Success!!!\n");
-			break;
+			double error = targets[i][k] - output[k];
+			sumOfSquareError += error * error;
 			}
-
-		// Thread.sleep(500)
-		getchar();
 		}
-
-	printf("Finished.\n");
+	return -sumOfSquareError / (NumTrials * numOutputs);
 	}
 
-
-//**************************** forward-propagation ***************************//
-void forward_gNN(int dim_V, double V[])
+// This seems to be independent of gene expression
+// INPUT: genome, with its fitness
+// OUTPUT: selected = the winner
+static void binaryTournament(int candidate)
 	{
-	// extern double output[][];
+	unsigned *state = &rngState[candidate];
 
-	// set the output of input layer
-	for (int n = 0; n < dim_V; ++n)
-		output[0][n] = V[n];
+	// Choose 2 candidates in the population
+	int i = rand_r(state) % populationSize;
+	int j = rand_r(state) % populationSize;
 
-	// calculate output from hidden layers to output layer
-	for (int l = 1; l < L; l++)
-		{
-		for (int n = 0; n < N; n++)
+	int p = (fitness[i] > fitness[j]) ? i : j;
+	memcpy(selected + candidate * geneStride, genome + p * geneStride, numCoeffs * sizeof (fftw_complex));
+	}
+
+// A point mutation moves a single Fourier coefficient
+static void pointMutation(fftw_complex *dna, double rate, unsigned *state)
+	{
+	for (int n = 0; n < numCoeffs; ++n)
+		if (uniform(state) < rate)
 			{
-			double v = 0; //induced local field for neurons
-			// calculate v, which is the sum of the product of input and weights
-			for (int k = 0; k <= N; k++)
-				{
-				if (k == 0)
-					v += population[l][n][k] * BIASOUTPUT;
-				else
-					v += population[l][n][k] *
-						output[l - 1][k - 1];
-				}
-
-			output[l][n] = sigmoid(v);
+			dna[n][0] += (uniform(state) * 2.0 - 1.0) * MutationSize;
+			dna[n][1] += (uniform(state) * 2.0 - 1.0) * MutationSize;
 			}
-		}
 	}
 
-//****************************** back-propagation ***************************//
-// The meaning of del (∇) is the "local gradient".  At the output layer, ∇ is equal to
-// the derivative σ'(summed inputs) times the error signal, while on hidden layers it is
-// equal to the derivative times the weighted sum of the ∇'s from the "next" layers.
-// From the algorithmic point of view, ∇ is derivative of the error with respect to the
-// summed inputs (for that particular neuron).  It changes for every input instance because
-// the error is dependent on the NN's raw input.  So, for each raw input instance, the
-// "local gradient" keeps changing.  I have a hypothesis that ∇ will fluctuate wildly
-// when the NN topology is "inadequate" to learn the target function.
-
-void backprop_gNN(double *errors)
+// Cross-over of 2 genes:  low frequencies from parent1, high frequencies from parent2
+static void crossOver(fftw_complex *result, fftw_complex *parent1, fftw_complex *parent2, double rate,
+					  unsigned *state)
 	{
-	// calculate gradient for output layer
-	for (int n = 0; n < N; ++n)
+	if (uniform(state) > rate)
 		{
-		double out = output[L - 1][n];
-		//for output layer, ∇ = y∙(1-y)∙error
-		#define steepness 1.0
-		grad[L - 1][n] = steepness * out * (1.0 - out) * errors[n];
+		memcpy(result, parent1, numCoeffs * sizeof (fftw_complex));
+		return;
 		}
 
-	// calculate gradient for hidden layers
-	for (int l = L - 2; l > 0; --l)		// for each hidden layer
-		{
-		for (int n = 0; n < N; n++)		// for each neuron in layer
-			{
-			double out = output[l][n];
-			double sum = 0.0f;
-			// nextLayer = l + 1;
-			for (int i = 0; i < N; i++)		// for each weight
-				{
-				sum += population[l + 1][i][n + 1]		// ignore weights[0] = bias
-						* grad[l + 1][i];
-				}
-			grad[l][n] = steepness * out * (1.0 - out) * sum;
-			}
-		}
+	int point = rand_r(state) % numCoeffs;
+	memcpy(result, parent1, point * sizeof (fftw_complex));
+	memcpy(result + point, parent2 + point, (numCoeffs - point) * sizeof (fftw_complex));
+	}
 
-	// update all weights
-	for (int l = 1; l < L; ++l)		// except for 0th layer which has no weights
-		{
-		for (int n = 0; n < N; n++)		// for each neuron
-			{
-			population[l][n][0] += Eta *
-					grad[l][n] * 1.0;		// 1.0f = bias input
-			for (int i = 0; i < N; i++)		// for each weight
-				{
-				double inputForThisNeuron = output[l - 1][i];
-				population[l][n][i + 1] += Eta *
-						grad[l][n] * inputForThisNeuron;
-				}
-			}
-		}
+// **** Reproduce 1 candidate, from the selected ones
+static void reproduce(int m, double crossRate, double mutationRate)
+	{
+	fftw_complex *p1, *p2;
+
+	p1 = selected + m * geneStride;
+	p2 = (m % 2 == 0) ? p1 + geneStride : p1 - geneStride;
+	if (m == populationSize - 1)
+		p2 = selected;
+
+	unsigned *state = &rngState[m];
+	crossOver(children + m * geneStride, p1, p2, crossRate, state);
+	pointMutation(children + m * geneStride, mutationRate, state);
 	}
 
-/*
-// Calculate error between output of forward-prop and a given answer Y
-double calc_error(NNET *net, double Y[], double *errors)
+// **** Tasks for the thread pool;  task = index of the candidate
+static void initTask(GSCRATCH *scratch, int m)
 	{
-	// calculate mean square error
-	// desired value = Y = K* = trainingOUT
-	double sumOfSquareError = 0;
-
-	int numLayers = net->numLayers;
-	LAYER lastLayer = net->layers[numLayers - 1];
-	// This means each output neuron corresponds to a classification label --YKY
-	for (int n = 0; n < lastLayer.numNeurons; n++)
-		{
-		//error = desired_value - output
-		double error = Y[n] - lastLayer.neurons[n].output;
-		errors[n] = error;
-		sumOfSquareError += error * error / 2;
-		}
-	double mse = sumOfSquareError / lastLayer.numNeurons;
-	return mse; //return mean square error
+	unsigned state = geneSeed(0, m);
+	for (int i = 0; i < numWeights; ++i)
+		weights[m * weightStride + i] = uniform(&state) * 2.0 - 1.0;	// w ∊ [-1,1]
 	}
 
-*/
+static void evaluateTask(GSCRATCH *scratch, int m)
+	{
+	fitness[m] = evaluateCandidate(weights + m * weightStride);
+	}
 
-/* No need to create neural network as it is stored in the population
- *
-//****************************create neural network*********************
-// GIVEN: how many layers, and how many neurons in each layer
-void create_gNN(NNET *net, int numLayers, int *neuronsPerLayer, double dna[][L])
+static void selectTask(GSCRATCH *scratch, int m)
 	{
-	srand(time(NULL));
-	net->numLayers = numLayers;
+	rngState[m] = geneSeed(currentGen, m);
+	binaryTournament(m);
+	}
 
-	assert(numLayers >= 3);
+static void reproduceTask(GSCRATCH *scratch, int m)
+	{
+	reproduce(m, CrossRate, MutationRate);
+	}
 
-	net->layers = (LAYER *) malloc(numLayers * sizeof (LAYER));
-	//construct input layer, no weights
-	net->layers[0].numNeurons = neuronsPerLayer[0];
-	net->layers[0].neurons = (NEURON *) malloc(neuronsPerLayer[0] * sizeof (NEURON));
+// Decode and evaluate the whole population;  returns the index of the best candidate.
+// The times spent are added to decodeTime and evalTime.
+static int evaluateFourierPopulation(double *decodeTime, double *evalTime)
+	{
+	double start = now();
+	decodePopulation();
+	double decoded = now();
+
+	runJob(evaluateTask, populationSize);
+	int best = 0;
+	for (int m = 1; m < populationSize; ++m)
+		if (fitness[m] > fitness[best])
+			best = m;
+	*decodeTime += decoded - start;
+	*evalTime += now() - decoded;
+	return best;
+	}
 
-	//construct hidden layers
-	for (int l = 1; l < numLayers; l++) //construct layers
-		{
-		net->layers[l].neurons = (NEURON *) malloc(neuronsPerLayer[l] * sizeof (NEURON));
-		net->layers[l].numNeurons = neuronsPerLayer[l];
-		for (int n = 0; n < neuronsPerLayer[l]; n++) // construct each neuron in the layer
+// Main algorithm for genetic search.  Returns the fitness of the best candidate.
+static double evolveFourier(unsigned seed, bool verbose, double *genTime, double *decodeTime)
+	{
+	runSeed = seed;
+
+	// **** initialize population:  random weights, w ∊ [-1,1], encoded as genes
+	runJob(initTask, populationSize);
+	fftw_execute(encodeMany);
+	for (int m = 0; m < populationSize; ++m)
+		for (int n = 0; n < numCoeffs; ++n)
 			{
-			net->layers[l].neurons[n].weights =
-					(double *) malloc((neuronsPerLayer[l - 1] + 1) * sizeof (double));
-			for (int i = 0; i <= neuronsPerLayer[l - 1]; i++)
-				{
-				//construct weights of neuron from previous layer neurons
-				//when k = 0, it's bias weight
-				net->layers[l].neurons[n].weights[i] = randomWeight();
-				//net->layers[i].neurons[j].weights[k] = 0.0f;
-				}
+			genome[m * geneStride + n][0] /= numWeights;
+			genome[m * geneStride + n][1] /= numWeights;
 			}
+
+	double evalTime = 0.0;
+	*decodeTime = 0.0;
+	double start = now();
+	int best = 0;
+	for (int i = 0; i < MaxGens; ++i)
+		{
+		drawFourierSamples(i);
+		best = evaluateFourierPopulation(decodeTime, &evalTime);
+		if (verbose)
+			printf("gen %03d: best error = %.5f\n", i, -fitness[best]);
+
+		currentGen = i + 1;
+		runJob(selectTask, populationSize);		// all the selections must finish before
+		runJob(reproduceTask, populationSize);	// the children are made
+		memcpy(genome, children, (size_t) populationSize * geneStride * sizeof (fftw_complex));
 		}
+	*genTime = (now() - start) / MaxGens;
+	*decodeTime /= MaxGens;
+	return fitness[best];
 	}
 
-void free_gNN(NNET *net, int *neuronsPerLayer)
+// The same evolution, with the genes decoded by 1 batched transform and 1 by 1
+void Fourier_evolve()
 	{
-	// for input layer
-	free(net->layers[0].neurons);
+	int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	setThreads(numThreads < 1 ? 1 : numThreads);
+	createPlans();
 
-	// for each hidden layer
-	int numLayers = net->numLayers;
-	for (int l = 1; l < numLayers; l++) // for each layer
+	double genTime[2], decodeTime[2], bestFitness[2];
+	for (int batched = 1; batched >= 0; --batched)
 		{
-		for (int n = 0; n < neuronsPerLayer[l]; n++) // for each neuron in the layer
-			{
-			free(net->layers[l].neurons[n].weights);
-			}
-		free(net->layers[l].neurons);
+		batchedFFT = batched;
+		bestFitness[batched] = evolveFourier(12345, batched, &genTime[batched], &decodeTime[batched]);
 		}
 
-	// free all layers
-	free(net->layers);
+	printf("\n                 ms/generation   decode ms/generation   best error\n");
+	for (int batched = 1; batched >= 0; --batched)
+		printf("%-16s %13.3f %22.4f %12.5f\n", batched ? "batched DFT" : "1 DFT per gene",
+			genTime[batched] * 1000.0, decodeTime[batched] * 1000.0, -bestFitness[batched]);
 
-	// free the whole net
-	free(net);
+	destroyPlans();
+	printf("Finished.\n");
 	}
-*/
@@ -0,0 +1,477 @@
+// Monte Carlo Tree Search player for tic-tac-toe, with the V-net (or the Q-net) as the
+// evaluator of the leaves, and many search threads sharing 1 tree.
+
+// **** Transposition table
+// The search runs on canonical boards only, and the nodes are kept in a table indexed by
+// [side to move][canonTable.id], so all the symmetric copies of a position and all the move
+// orders that reach it share 1 node.  The id is a perfect hash of the board, so the table
+// needs no keys, probing or locks:  the statistics of a node are atomics, updated by all
+// the threads at once.  A node's children and priors are written once, by the thread that
+// claims its expansion, and published by storing Expanded (release).
+
+// **** Search
+// Each thread repeatedly
+//	1. selects up to LeafBatch leaves by PUCT.  Every node on the way gets a virtual loss,
+//	   so that the next selections (in this thread and the others) try other paths;
+//	2. evaluates all these leaves in 1 batched forward pass, with its own BATCH (the nets
+//	   are only read during the search);
+//	3. expands the leaves with the priors, and backs up the values, removing the virtual
+//	   losses.
+// The values are for player 1 (V-net outputs, 1 = player 1 wins), as in V1.
+// The priors of a node's children are softmax(mover's value / PriorTemp), where the
+// mover's values come from the V-net (V of the child boards), or from the Q-net
+// (Q(board, child board), with the boards negated when player -1 is to move).
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>		// memset
+#include <list>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <math.h>		// sqrt, exp
+#include "feedforward-NN.h"
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+extern "C"
+	{
+	// from V-learning.c and Q-learning.c
+	extern NNET *Vnet;
+	extern NNET *Qnet;
+	void load_Vnet(void);
+	void load_Qnet(char const *);
+
+	// from back-prop.c
+	BATCH *create_batch(NNET *, int);
+	void free_batch(BATCH *);
+	void forward_prop_sigmoid_batch(NNET *, BATCH *, int, int, double *);
+
+	// functions from visualization.c
+	void beep();
+	}
+
+// ******** Functions from tic-tac-toe.cpp, V-table.cpp and minimax.cpp
+extern State board;
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int hasWinner(const State &s);
+extern int greedyMove(VTable &V, int player);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+extern double scoreMover(const char *name, int player, std::function<int ()> mover);
+
+#define CPuct				1.5
+#define FirstPlayUrgency	0.5			// value of unvisited children, ie, a draw
+#define PriorTemp			0.1
+#define LeafBatch			8			// leaves evaluated together, per thread
+
+#define Unexpanded	0
+#define Expanding	1
+#define Expanded	2
+
+struct Node
+	{
+	atomic<int> N;					// visits
+	atomic<int> virtualLoss;		// searches in progress through this node
+	atomic<double> W;				// sum of the values backed up, for player 1
+	atomic<int> expanded;
+
+	int numChildren;				// only valid when expanded == Expanded
+	unsigned short child[9];		// canonTable ids of the distinct successors
+	float prior[9];
+	};
+
+static Node tree[2][NumCanon];		// [0] = player 1 to move, [1] = player -1
+
+static inline Node &node(int side, int id)
+	{
+	return tree[side == 1 ? 0 : 1][id];
+	}
+
+// Forget all the statistics
+void mcts_clear()
+	{
+	memset((void *) tree, 0, sizeof tree);
+	}
+
+static inline void atomicAdd(atomic<double> &a, double x)
+	{
+	double old = a.load(memory_order_relaxed);
+	while (!a.compare_exchange_weak(old, old + x, memory_order_relaxed))
+		;
+	}
+
+// Value of a finished game for player 1, or -1 if the game is not over
+static inline double terminalValue(const State &s)
+	{
+	int won = hasWinner(s);
+	if (won == 0)
+		return -1.0;
+	return (won == -2) ? 0.5 : (won == 1) ? 1.0 : 0.0;
+	}
+
+// The distinct canonical successors of the canonical board c
+static int children(const State &c, int side, unsigned short ids[9])
+	{
+	int moves[9];
+	State next[9];
+	int n = legalMoves(c, side, moves, next), count = 0;
+	for (int m = 0; m < n; ++m)
+		{
+		unsigned short id = canonTable.id[stateIndex(next[m])];
+		bool seen = false;
+		for (int j = 0; j < count; ++j)
+			seen = seen || (ids[j] == id);
+		if (!seen)
+			ids[count++] = id;
+		}
+	return count;
+	}
+
+// Choose the child of parent (side to move) with the highest PUCT score
+static int selectChild(Node &parent, int side)
+	{
+	double sqrtN = sqrt((double) max(1, parent.N.load(memory_order_relaxed) +
+		parent.virtualLoss.load(memory_order_relaxed)));
+
+	int best = 0;
+	double bestScore = -1e30;
+	for (int j = 0; j < parent.numChildren; ++j)
+		{
+		Node &c = node(-side, parent.child[j]);
+		int n = c.N.load(memory_order_relaxed) + c.virtualLoss.load(memory_order_relaxed);
+		double q = FirstPlayUrgency;
+		if (n > 0)
+			{
+			// virtual losses count as losses for the mover
+			double w = c.W.load(memory_order_relaxed);
+			q = ((side == 1) ? w : c.N.load(memory_order_relaxed) - w) / n;
+			}
+		double score = q + CPuct * parent.prior[j] * sqrtN / (1 + n);
+		if (score > bestScore)
+			{
+			bestScore = score;
+			best = j;
+			}
+		}
+	return best;
+	}
+
+struct Leaf
+	{
+	Node *path[10];
+	int length;
+	int side;						// to move at the leaf
+	int id;
+	bool evaluate;					// false = the game is over, value is known
+	bool expand;					// this thread has claimed the expansion
+	int numChildren;
+	unsigned short child[9];
+	double value;
+	};
+
+// Per-thread scratch space for evaluating leaves
+struct Searcher
+	{
+	bool useQ;
+	BATCH *vBatch = NULL;
+	BATCH *qBatch = NULL;
+	vector<double> vRows, qRows;
+	Leaf leaves[LeafBatch];
+
+	Searcher(bool useQ) : useQ(useQ)
+		{
+		vBatch = create_batch(Vnet, LeafBatch * 10);
+		if (useQ)
+			qBatch = create_batch(Qnet, LeafBatch * 9);
+		}
+	~Searcher()
+		{
+		free_batch(vBatch);
+		if (qBatch != NULL)
+			free_batch(qBatch);
+		}
+	};
+
+// Walk down from the root to a leaf, adding virtual losses
+static void selectLeaf(int rootSide, int rootId, Leaf &leaf)
+	{
+	int side = rootSide, id = rootId;
+	Node *n = &node(side, id);
+	leaf.length = 0;
+	while (true)
+		{
+		n->virtualLoss.fetch_add(1, memory_order_relaxed);
+		leaf.path[leaf.length++] = n;
+		if (n->expanded.load(memory_order_acquire) != Expanded)
+			break;
+		id = n->child[selectChild(*n, side)];
+		side = -side;
+		n = &node(side, id);
+		}
+	leaf.side = side;
+	leaf.id = id;
+
+	leaf.value = terminalValue(canonTable.board[id]);
+	leaf.evaluate = (leaf.value < 0.0);
+	leaf.expand = false;
+	if (leaf.evaluate)
+		{
+		int expected = Unexpanded;
+		leaf.expand = n->expanded.compare_exchange_strong(expected, Expanding);
+		}
+	}
+
+// Evaluate the leaves in 1 forward pass of the V-net (and 1 of the Q-net)
+static void evaluateLeaves(Searcher &S, int numLeaves)
+	{
+	S.vRows.clear();
+	S.qRows.clear();
+	for (int i = 0; i < numLeaves; ++i)
+		{
+		Leaf &leaf = S.leaves[i];
+		if (!leaf.evaluate)
+			continue;
+		const State &s = canonTable.board[leaf.id];
+		Board b = s.array();
+		S.vRows.insert(S.vRows.end(), b.x, b.x + 9);
+		if (!leaf.expand)
+			continue;
+
+		leaf.numChildren = children(s, leaf.side, leaf.child);
+		for (int j = 0; j < leaf.numChildren; ++j)
+			{
+			Board c = canonTable.board[leaf.child[j]].array();
+			if (!S.useQ)
+				S.vRows.insert(S.vRows.end(), c.x, c.x + 9);
+			else
+				{
+				for (int k = 0; k < 9; ++k)
+					S.qRows.push_back(leaf.side * b.x[k]);
+				for (int k = 0; k < 9; ++k)
+					S.qRows.push_back(leaf.side * c.x[k]);
+				}
+			}
+		}
+
+	int vCount = S.vRows.size() / 9, qCount = S.qRows.size() / 18;
+	if (vCount > 0)
+		forward_prop_sigmoid_batch(Vnet, S.vBatch, vCount, 9, S.vRows.data());
+	if (qCount > 0)
+		forward_prop_sigmoid_batch(Qnet, S.qBatch, qCount, 18, S.qRows.data());
+	double *V = S.vBatch->outputs[Vnet->numLayers - 1];
+	double *Q = S.useQ ? S.qBatch->outputs[Qnet->numLayers - 1] : NULL;
+
+	int v = 0, q = 0;
+	for (int i = 0; i < numLeaves; ++i)
+		{
+		Leaf &leaf = S.leaves[i];
+		if (!leaf.evaluate)
+			continue;
+		leaf.value = V[v++];
+		if (!leaf.expand)
+			continue;
+
+		// priors = softmax of the mover's values
+		Node &n = *leaf.path[leaf.length - 1];
+		double p[9], maxP = -1e30, sum = 0.0;
+		for (int j = 0; j < leaf.numChildren; ++j)
+			{
+			if (S.useQ)
+				p[j] = Q[q++];
+			else
+				p[j] = (leaf.side == 1) ? V[v++] : 1.0 - V[v++];
+			maxP = max(maxP, p[j]);
+			}
+		for (int j = 0; j < leaf.numChildren; ++j)
+			sum += (p[j] = exp((p[j] - maxP) / PriorTemp));
+		for (int j = 0; j < leaf.numChildren; ++j)
+			{
+			n.child[j] = leaf.child[j];
+			n.prior[j] = p[j] / sum;
+			}
+		n.numChildren = leaf.numChildren;
+		n.expanded.store(Expanded, memory_order_release);
+		}
+	}
+
+static void backup(Leaf &leaf)
+	{
+	for (int i = 0; i < leaf.length; ++i)
+		{
+		Node *n = leaf.path[i];
+		atomicAdd(n->W, leaf.value);
+		n->N.fetch_add(1, memory_order_relaxed);
+		n->virtualLoss.fetch_sub(1, memory_order_relaxed);
+		}
+	}
+
+// Each batch takes leaves from the shared budget of playouts, until it is used up or
+// the deadline has passed
+static void searchThread(Searcher *S, int side, int id, atomic<long> *budget,
+						 chrono::steady_clock::time_point deadline, bool timed)
+	{
+	while (true)
+		{
+		long left = budget->fetch_sub(LeafBatch, memory_order_relaxed);
+		if (left <= 0 || (timed && chrono::steady_clock::now() >= deadline))
+			break;
+
+		int numLeaves = (int) min<long>(left, LeafBatch);
+		for (int i = 0; i < numLeaves; ++i)
+			selectLeaf(side, id, S->leaves[i]);
+		evaluateLeaves(*S, numLeaves);
+		for (int i = 0; i < numLeaves; ++i)
+			backup(S->leaves[i]);
+		}
+	}
+
+// **** Search from s with player to move, and return the most visited move.
+// The search stops after playouts playouts, or after maxMs milliseconds if maxMs > 0.
+// Statistics from earlier searches are kept (see mcts_clear), as is any other
+// transposition.  Returns -1 if the game is over.
+int mctsMove(const State &s, int player, long playouts, double maxMs, int numThreads, bool useQ)
+	{
+	int moves[9];
+	State next[9];
+	int n = legalMoves(s, player, moves, next);
+	if (n == 0 || hasWinner(s) != 0)
+		return -1;
+
+	int rootId = canonTable.id[stateIndex(s)];
+	Node &root = node(player, rootId);
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+		chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(maxMs));
+
+	// Expand the root first, so the threads do not all wait for it
+	vector<Searcher *> searchers;
+	for (int t = 0; t < numThreads; ++t)
+		searchers.push_back(new Searcher(useQ));
+	atomic<long> budget(playouts);
+	if (root.expanded.load() != Expanded)
+		{
+		atomic<long> one(1);
+		searchThread(searchers[0], player, rootId, &one, deadline, false);
+		budget -= 1;
+		}
+
+	vector<thread> threads;
+	for (int t = 1; t < numThreads; ++t)
+		threads.push_back(thread(searchThread, searchers[t], player, rootId, &budget, deadline, maxMs > 0.0));
+	searchThread(searchers[0], player, rootId, &budget, deadline, maxMs > 0.0);
+	for (thread &th : threads)
+		th.join();
+	for (Searcher *S : searchers)
+		delete S;
+
+	// The most visited child, found among the real successors of s
+	int bestMove = moves[0], bestN = -1;
+	for (int m = 0; m < n; ++m)
+		{
+		int visits = node(-player, canonTable.id[stateIndex(next[m])]).N.load();
+		if (visits > bestN)
+			{
+			bestN = visits;
+			bestMove = moves[m];
+			}
+		}
+	return bestMove;
+	}
+
+// **** Benchmark:  strength against search budget, and speed against threads
+extern "C" void mcts_benchmark()
+	{
+	std::list<State> states2;
+	static VTable V2;
+	cout << "Loading player -1...\n";
+	int totalStates2 = loadValues("ttt2", states2, V2);
+	cout << "Total read: " << to_string(totalStates2) << "\n";
+
+	cout << "[v] = V-net values and priors (v.net)\n";
+	cout << "[q] = V-net values, Q-net priors (v.net, Q.net)\n";
+	char key;
+	do
+		key = getchar();
+	while (key == '\n');
+	bool useQ = (key == 'q');
+	load_Vnet();
+	if (useQ)
+		load_Qnet("Q.net");
+
+	int maxThreads = thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	// Strength:  moves against optimal play, and games against greedy V2 (which explores)
+	#define NumGames		200
+	#define exploreRate		0.1
+	const long budgets[] = {16, 64, 256, 1024, 4096};
+	for (long playouts : budgets)
+		{
+		char name[64];
+		sprintf(name, "MCTS, %ld playouts", playouts);
+		scoreMover(name, 1, [&]()
+			{
+			mcts_clear();
+			return mctsMove(board, 1, playouts, 0.0, maxThreads, useQ);
+			});
+
+		srand(12345);
+		State saved = board;
+		int wins1 = 0, wins_1 = 0, draws = 0;
+		for (int g = 0; g < NumGames; ++g)
+			{
+			mcts_clear();
+			board = State();
+			int player = (rand() % 2) ? 1 : -1;
+			int won;
+			do
+				{
+				int move;
+				if (player == 1)
+					move = mctsMove(board, 1, playouts, 0.0, maxThreads, useQ);
+				else if (rand() / (double) RAND_MAX <= exploreRate)
+					{
+					unsigned blanks = board.blanks();
+					move = nthSquare(blanks, rand() % __builtin_popcount(blanks));
+					}
+				else
+					move = greedyMove(V2, -1);
+				board.set(move, player);
+				player = -player;
+				}
+			while ((won = hasWinner(board)) == 0);
+
+			if (won == 1)
+				++wins1;
+			else if (won == -1)
+				++wins_1;
+			else
+				++draws;
+			}
+		board = saved;
+		printf("   against V2:  %.1f%% wins, %.1f%% losses, %.1f%% draws\n",
+			wins1 * 100.0 / NumGames, wins_1 * 100.0 / NumGames, draws * 100.0 / NumGames);
+		}
+
+	// Speed:  1 long search from the empty board
+	#define SpeedPlayouts	400000
+	printf("\n threads   playouts/sec  speedup\n");
+	double base = 0.0;
+	for (int t = 1; ; t = min(t * 2, maxThreads))
+		{
+		mcts_clear();
+		auto start = chrono::steady_clock::now();
+		mctsMove(State(), 1, SpeedPlayouts, 0.0, t, useQ);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (t == 1)
+			base = SpeedPlayouts / seconds;
+		printf("%8d %14.0f %8.2f\n", t, SpeedPlayouts / seconds, SpeedPlayouts / seconds / base);
+		if (t == maxThreads)
+			break;
+		}
+	beep();
+	}
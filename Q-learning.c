@@ -22,6 +22,7 @@
 #include <math.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "feedforward-NN.h"
 
@@ -31,6 +32,18 @@ extern NNET *create_NN(int numberOfLayers, int *neuronsPerLayer);
 extern void forward_prop_sigmoid(NNET *, int, double *);
 extern double calc_error(NNET *net, double *Y);
 extern void back_prop(NNET *, double *errors);
+extern void back_prop_input(NNET *, double *errors, double *gradV);
+extern BATCH *create_batch(NNET *, int);
+extern INCR *create_incr(NNET *);
+extern void free_incr(INCR *);
+extern void invalidate_incr(INCR *);
+extern void forward_prop_sigmoid_incr(NNET *, INCR *, int, double *);
+extern void free_batch(BATCH *);
+extern void forward_prop_sigmoid_batch(NNET *, BATCH *, int, int, double *);
+extern void back_prop_input_batch(NNET *, BATCH *, int, double *errors, double *gradV);
+extern void back_prop_batch(NNET *, BATCH *, int, double *errors);
+extern NNET *clone_NN(NNET *);
+extern void sync_NN(NNET *dst, NNET *src);
 extern void plot_W(NNET *);
 extern void start_W_plot(void);
 
@@ -41,6 +54,30 @@ NNET *Qnet;
 int QnumLayers = 4;
 int QneuronsPerLayer[] = {dimK * 2, 10, 7, 1};
 
+// Cache for incremental evaluation in getQ(), since K usually stays the same while K2
+// varies.  It must be invalidated whenever Qnet's weights change.
+INCR *Qcache = NULL;
+
+// **** Target network
+// The targets R + γ max_a Q(K2,a) in Q-learning are computed with the same Q-net that is
+// being updated, so the targets keep moving with every update.  Optionally, the targets
+// are instead computed with a frozen copy, Qtarget, which is synced with Qnet only every
+// TargetSyncEvery updates (a single memcpy of the weight block).
+NNET *Qtarget = NULL;
+int targetSyncEvery = 0;		// 0 = no target network
+int updatesSinceSync = 0;
+
+INCR *getQcache()
+	{
+	if (Qcache == NULL || Qcache->net != Qnet)
+		{
+		if (Qcache != NULL)
+			free_incr(Qcache);
+		Qcache = create_incr(Qnet);
+		}
+	return Qcache;
+	}
+
 void init_Qnet()
 	{
 	// int numLayers2 = 5;
@@ -53,6 +90,7 @@ void init_Qnet()
 	Qnet = (NNET*) malloc(sizeof (NNET));
 	//create neural network for backpropagation
 	Qnet = create_NN(QnumLayers, QneuronsPerLayer);
+	invalidate_incr(getQcache());
 
 	start_W_plot();
 	// return Qnet;
@@ -64,6 +102,7 @@ void load_Qnet(char *fname)
 	int *neuronsPerLayer2;
 	extern NNET * loadNet(int *, int *p[], char *);
 	Qnet = loadNet(&numLayers2, &neuronsPerLayer2, fname);
+	invalidate_incr(getQcache());
 	// LAYER lastLayer = Vnet->layers[numLayers - 1];
 
 	return;
@@ -102,13 +141,63 @@ double getQ(double K[], double K2[])
 		K12[k + dimK] = (double) K2[k];
 		}
 
-	forward_prop_sigmoid(Qnet, dimK * 2, K12);
+	forward_prop_sigmoid_incr(Qnet, getQcache(), dimK * 2, K12);
 
 	LAYER LastLayer = (Qnet->layers[QnumLayers - 1]);
 	// The last layer has only 1 neuron, which outputs the Q value:
 	return LastLayer.neurons[0].output;
 	}
 
+// Finds Q(K,K2) for n different K2's in one batched forward-propagation
+// K2s holds the n vectors K2 one after another.
+
+void getQ_batch(double K[], int n, double K2s[], double Qs[])
+	{
+	static BATCH *batch = NULL;
+	static NNET *batchNet = NULL;		// the net that the batch was made for
+	if (batch == NULL || batchNet != Qnet || batch->size < n)
+		{
+		if (batch != NULL)
+			free_batch(batch);
+		batch = create_batch(Qnet, n > 9 ? n : 9);
+		batchNet = Qnet;
+		}
+
+	double K12[n * dimK * 2];
+	for (int i = 0; i < n; ++i)
+		for (int k = 0; k < dimK; ++k)
+			{
+			K12[i * dimK * 2 + k] = (double) K[k];
+			K12[i * dimK * 2 + k + dimK] = (double) K2s[i * dimK + k];
+			}
+
+	forward_prop_sigmoid_batch(Qnet, batch, n, dimK * 2, K12);
+
+	// The last layer has only 1 neuron, which outputs the Q value:
+	for (int i = 0; i < n; ++i)
+		Qs[i] = batch->outputs[QnumLayers - 1][i];
+	}
+
+// Q(K1,K2) of n unrelated pairs in one forward pass, eg. positions of different games.
+// Each row of K12s is K1 followed by K2.
+void getQ_pairs(int n, double K12s[], double Qs[])
+	{
+	static BATCH *batch = NULL;
+	static NNET *batchNet = NULL;		// the net that the batch was made for
+	if (batch == NULL || batchNet != Qnet || batch->size < n)
+		{
+		if (batch != NULL)
+			free_batch(batch);
+		batch = create_batch(Qnet, n > 9 ? n : 9);
+		batchNet = Qnet;
+		}
+
+	forward_prop_sigmoid_batch(Qnet, batch, n, dimK * 2, K12s);
+
+	for (int i = 0; i < n; ++i)
+		Qs[i] = batch->outputs[QnumLayers - 1][i];
+	}
+
 // returns the Euclidean norm (absolute value, or size) of the gradient vector
 
 double norm(double grad[dimK])
@@ -147,6 +236,7 @@ void train_Q(int s[dimK], double Q)
 
 		back_prop(Qnet, error);
 		}
+	invalidate_incr(getQcache());
 
 	if (++count == 1000)
 		{
@@ -174,15 +264,14 @@ void train_Q(int s[dimK], double Q)
 
 void Q_learn(int K1[dimK], int K2[dimK], double R)
 	{
-	double maxQ(int [dimK], double [dimK]);
-	double K_out[dimK];
+	double targetMaxQ(int [dimK]);
 
 	#define Gamma	0.95
 	#define Eta		0.2
 
 	// Calculate ΔQ = η { R + γ max_a Q(K2,a) }
 	double dQ[1];
-	dQ[0] = Eta * (R + Gamma * maxQ(K2, K_out));
+	dQ[0] = Eta * (R + Gamma * targetMaxQ(K2));
 
 	// Adjust old Q value
 	// oldQ += dQ;
@@ -202,6 +291,10 @@ void Q_learn(int K1[dimK], int K2[dimK], double R)
 
 		back_prop(Qnet, dQ);
 		}
+	invalidate_incr(getQcache());
+
+	void countUpdate(void);
+	countUpdate();
 	}
 
 // **** Learn a simple V-value map via backprop
@@ -238,104 +331,509 @@ void learn_V(int s2[dimK], int s[dimK])
 
 // (Part 1) Q-acting:
 // Find K2 that maximizes Q(K,K2).  Q is a real number.
-// Method: numerical differentiation to find the gradient ∇Q = [∂Q/∂K2] which is a vector.
-//		The approximation formula for each component of ∂Q/∂K2 is:  (subscripts omitted)
-//			∂Q/∂K2 ≈ { Q(K2 + δ) - Q(K2 - δ) } /2δ
+// Method: gradient ascent, where the gradient ∇Q = [∂Q/∂K2] is obtained analytically by
+//		back-propagating to the input layer of the Q-net.  This costs 1 forward + 1 backward
+//		sweep per step, instead of the 2·dimK forward sweeps of numerical differentiation.
+// K2 is kept inside the box [-1,+1]^dimK, which is the range of board values.
 // TO-DO: Perhaps with multiple random restarts
 // Note: function changes the components of K2.
 
-void Q_act(double K[dimK], double K2[dimK])
+// Computes Q(K,K2) and the gradient [∂Q/∂K2]; returns the Q value.
+double gradQ_K2(double K[dimK], double K2[dimK], double gradQ[dimK])
+	{
+	double Q = getQ(K, K2);					// forward-prop, prepares local gradients
+
+	double one[1] = {1.0};					// ∂Q/∂Q = 1
+	double gradK12[dimK * 2];
+	back_prop_input(Qnet, one, gradK12);
+
+	// Only the K2 half of the input gradient is needed
+	for (int k = 0; k < dimK; ++k)
+		gradQ[k] = gradK12[k + dimK];
+	return Q;
+	}
+
+// Move K2 uphill along ∇Q until the gradient vanishes, or MaxTries steps have been taken.
+// Components stuck at the box boundary with the gradient pointing outwards are not counted
+// in the gradient norm (projected gradient).
+// Returns the number of steps taken.
+int ascendQ(double K[dimK], double K2[dimK])
 	{
 	double gradQ[dimK]; // the gradient vector ∇Q = [∂Q/∂K2]
+	double gradSize;
 
-	do // While change is smaller than threshold
+	#define Lambda		0.1
+	#define Epsilon		0.1
+	#define MaxTries	20000
+	int tries = 0;
+	do
 		{
-		// Start with a random K2
-		for (int k = 0; k < dimK; ++k)
-			K2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
+		gradQ_K2(K, K2, gradQ);
 
-		// Find the steepest direction [∂Q/∂K2], using numerical differentiation.
-		#define delta	0.1
+		// Move a little along the gradient direction: K2 += λ ∇Q
 		for (int k = 0; k < dimK; ++k)
 			{
-			// Create 2 copies of K2, whose k-th component is added / subtracted with δ
-			double K2plus[dimK], K2minus[dimK];
-			for (int k2 = 0; k2 < dimK; ++k2)
-				K2plus[k2] = K2minus[k2] = K2[k2];
-			K2plus[k] += delta;
-			K2minus[k] -= delta;
-
-			gradQ[k] = (getQ(K, K2plus) - getQ(K, K2minus)) / 2 / delta;
+			K2[k] += Lambda * gradQ[k];
+			if (K2[k] > 1.0)
+				K2[k] = 1.0, gradQ[k] = 0.0;
+			else if (K2[k] < -1.0)
+				K2[k] = -1.0, gradQ[k] = 0.0;
 			}
 
-		// Move a little along the gradient direction: K2 += -λ ∇Q
-		// (There seems to be a negative sign in the above formula)
-		#define Lambda	0.1
-		for (int k = 0; k < dimK; ++k)
-			K2[k] += (-Lambda * gradQ[k]);
+		gradSize = norm(gradQ);
+		// printf("gradient norm = %f\r", gradSize);
+		++tries;
 		}
-		#define Epsilon 0.005
-		while (norm(gradQ) > Epsilon);
+	while (gradSize > Epsilon && tries < MaxTries);
+
+	return tries;
+	}
+
+void Q_act(double K[dimK], double K2[dimK])
+	{
+	// Start with a random K2
+	for (int k = 0; k < dimK; ++k)
+		K2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
+
+	ascendQ(K, K2);
 
 	// Return with optimal K2 value
 	}
 
 // Find maximum Q(K,K') value at state K, by varying K'.
-// Method: gradient descent, using numerical differentiation to find the gradient [∂Q/∂K'].
-// Algorithm is similar to above.
+// Method: gradient ascent, same as above.
 // 2nd argument is a place-holder.
 double maxQ(int K[dimK], double K2[dimK])
 	{
-	double gradQ[dimK]; // the gradient vector ∇Q = [∂Q/∂K2]
 	double K1[dimK];
-	double gradSize;
 
 	for (int k = 0; k < dimK; ++k)
 		K1[k] = (double) K[k];
 
-	int tries = 0;
-	do // While change is smaller than threshold
+	// Start with a random K2
+	for (int k = 0; k < dimK; ++k)
+		K2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
+
+	int tries = ascendQ(K1, K2);
+
+	if (tries >= MaxTries)						// need to handle exception here
+		{
+		printf("fail: ");
+		// The result in K2 may still be usable?
+		}
+
+	double result = getQ(K1, K2);
+	// printf("%2.3f ", result);
+
+	static int count = 0;
+	if (++count == 1000)
 		{
-		// Start with a random K2
+		plot_W(Qnet);
+		count = 0;
+		}
+	return result; // return Q value
+	}
+
+// **** Multi-start version of maxQ
+// S random starting points K2 are moved uphill simultaneously, as one batch through the
+// Q-net (1 batched forward + backward sweep per step).  A start drops out of the batch as
+// soon as its gradient vanishes, so the batch shrinks as it converges;  it stops when all
+// starts have converged, or after MaxTries steps.
+// OUTPUT:	K2best = the K2 with the highest Q value, which is returned
+//			optima = all S local optima (S × dimK), Qs = their Q values (either may be NULL)
+// With numThreads > 1 and enough starts, the starts are split among that many threads,
+// each with its own batch scratch space.  Starting points are drawn before splitting, so
+// the results do not depend on the number of threads.
+
+typedef struct
+	{
+	NNET *net;			// the Q-net to be maximized
+	double *K1;			// the state K, shared by all starts (K1stride = 0) or 1 per start
+	int K1stride;		// 0 or dimK
+	double *K2;			// n starting points → local optima
+	double *Qs;			// n Q values
+	int n;
+	} ASCENT;
+
+void *ascendQ_batch(void *arg)
+	{
+	ASCENT *job = (ASCENT *) arg;
+	int n = job->n;
+
+	BATCH *batch = create_batch(job->net, n);
+	double *K12 = (double *) malloc(n * dimK * 2 * sizeof (double));
+	double *gradK12 = (double *) malloc(n * dimK * 2 * sizeof (double));
+	double *ones = (double *) malloc(n * sizeof (double));
+	int *active = (int *) malloc(n * sizeof (int));		// rows still climbing
+
+	for (int b = 0; b < n; ++b)
+		{
+		active[b] = b;
+		ones[b] = 1.0;
+		}
+
+	int numActive = n;
+	for (int tries = 0; numActive > 0 && tries < MaxTries; ++tries)
+		{
+		// Pack the active starts into the batch
+		for (int a = 0; a < numActive; ++a)
+			for (int k = 0; k < dimK; ++k)
+				{
+				K12[a * dimK * 2 + k] = job->K1[active[a] * job->K1stride + k];
+				K12[a * dimK * 2 + k + dimK] = job->K2[active[a] * dimK + k];
+				}
+
+		forward_prop_sigmoid_batch(job->net, batch, numActive, dimK * 2, K12);
+		back_prop_input_batch(job->net, batch, numActive, ones, gradK12);
+
+		// Move each start a little along its gradient, retire the converged ones
+		int stillActive = 0;
+		for (int a = 0; a < numActive; ++a)
+			{
+			double *K2 = job->K2 + active[a] * dimK;
+			double *gradQ = gradK12 + a * dimK * 2 + dimK;
+			for (int k = 0; k < dimK; ++k)
+				{
+				K2[k] += Lambda * gradQ[k];
+				if (K2[k] > 1.0)
+					K2[k] = 1.0, gradQ[k] = 0.0;
+				else if (K2[k] < -1.0)
+					K2[k] = -1.0, gradQ[k] = 0.0;
+				}
+			if (norm(gradQ) > Epsilon)
+				active[stillActive++] = active[a];
+			}
+		numActive = stillActive;
+		}
+
+	// Final Q values of all starts
+	for (int b = 0; b < n; ++b)
 		for (int k = 0; k < dimK; ++k)
-			K2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
+			{
+			K12[b * dimK * 2 + k] = job->K1[b * job->K1stride + k];
+			K12[b * dimK * 2 + k + dimK] = job->K2[b * dimK + k];
+			}
+	forward_prop_sigmoid_batch(job->net, batch, n, dimK * 2, K12);
+	for (int b = 0; b < n; ++b)
+		job->Qs[b] = batch->outputs[QnumLayers - 1][b];	// output layer has 1 neuron
+
+	free(active);
+	free(ones);
+	free(gradK12);
+	free(K12);
+	free_batch(batch);
+	return NULL;
+	}
 
-		// Find the steepest direction [∂Q/∂K2], using numerical differentiation.
-		#define delta	0.001
+double maxQ_multi(int K[dimK], int S, double K2best[dimK], double *optima, double *Qs, int numThreads)
+	{
+	double K1[dimK];
+	for (int k = 0; k < dimK; ++k)
+		K1[k] = (double) K[k];
+
+	double *K2 = (double *) malloc(S * dimK * sizeof (double));
+	double *Q = (double *) malloc(S * sizeof (double));
+
+	// Random starting points, in [+1,-1]
+	for (int i = 0; i < S * dimK; ++i)
+		K2[i] = (rand() / (float) RAND_MAX) * 2.0 - 1.0;
+
+	// Threads are only worth it for large batches
+	#define MinStartsPerThread	32
+	if (numThreads > S / MinStartsPerThread)
+		numThreads = S / MinStartsPerThread;
+	if (numThreads < 1)
+		numThreads = 1;
+
+	ASCENT jobs[numThreads];
+	pthread_t threads[numThreads];
+	for (int t = 0, first = 0; t < numThreads; ++t)
+		{
+		int n = S / numThreads + (t < S % numThreads ? 1 : 0);
+		jobs[t].net = Qnet;
+		jobs[t].K1 = K1;
+		jobs[t].K1stride = 0;
+		jobs[t].K2 = K2 + first * dimK;
+		jobs[t].Qs = Q + first;
+		jobs[t].n = n;
+		first += n;
+		}
+
+	if (numThreads == 1)
+		ascendQ_batch(&jobs[0]);
+	else
+		{
+		for (int t = 0; t < numThreads; ++t)
+			pthread_create(&threads[t], NULL, ascendQ_batch, &jobs[t]);
+		for (int t = 0; t < numThreads; ++t)
+			pthread_join(threads[t], NULL);
+		}
+
+	int best = 0;
+	for (int s = 1; s < S; ++s)
+		if (Q[s] > Q[best])
+			best = s;
+	for (int k = 0; k < dimK; ++k)
+		K2best[k] = K2[best * dimK + k];
+	double result = Q[best];
+
+	if (optima != NULL)
+		for (int i = 0; i < S * dimK; ++i)
+			optima[i] = K2[i];
+	if (Qs != NULL)
+		for (int s = 0; s < S; ++s)
+			Qs[s] = Q[s];
+
+	free(Q);
+	free(K2);
+	return result;
+	}
+
+// Turn the target network on (syncEvery > 0) or off (syncEvery = 0).
+// Qtarget starts as a copy of the current Qnet.
+void init_Qtarget(int syncEvery)
+	{
+	targetSyncEvery = syncEvery;
+	updatesSinceSync = 0;
+	if (syncEvery <= 0)
+		return;
+
+	if (Qtarget == NULL || Qtarget->numWeights != Qnet->numWeights)
+		Qtarget = clone_NN(Qnet);
+	else
+		sync_NN(Qtarget, Qnet);
+	}
+
+// The net that the Q-learning targets are computed with
+NNET *targetNet()
+	{
+	return (targetSyncEvery > 0) ? Qtarget : Qnet;
+	}
+
+// Called after every update of Qnet
+void countUpdate()
+	{
+	if (targetSyncEvery > 0 && ++updatesSinceSync >= targetSyncEvery)
+		{
+		sync_NN(Qtarget, Qnet);
+		updatesSinceSync = 0;
+		}
+	}
+
+// max_a Q(K,a) according to the target network, from 1 random starting point
+double targetMaxQ(int K[dimK])
+	{
+	double K2[dimK];
+	if (targetSyncEvery <= 0)
+		return maxQ(K, K2);
+
+	double K1[dimK], Q;
+	for (int k = 0; k < dimK; ++k)
+		{
+		K1[k] = (double) K[k];
+		K2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
+		}
+	ASCENT job = {Qtarget, K1, 0, K2, &Q, 1};
+	ascendQ_batch(&job);
+	return Q;
+	}
+
+// **** Snapshot of Qnet's weights, so that several runs can start from the same net
+// (create_NN seeds its random weights with the time)
+NNET *Qstart = NULL;
+
+void save_Qstart()
+	{
+	if (Qstart == NULL || Qstart->numWeights != Qnet->numWeights)
+		Qstart = clone_NN(Qnet);
+	else
+		sync_NN(Qstart, Qnet);
+	}
+
+void restore_Qstart()
+	{
+	sync_NN(Qnet, Qstart);
+	invalidate_incr(getQcache());
+	}
+
+// **** Experience replay
+// Instead of learning from each transition (K1 → K2, R) once, right after it happened,
+// the transitions are stored in a fixed-size ring buffer ("replay memory"), and the
+// Q-net learns from random mini-batches drawn from it.  This breaks the correlation
+// between successive updates, and each update becomes one batched back-prop.
+// Sampling is either uniform, or proportional to priority^α, where the priority of a
+// transition is the size of its last ΔQ (prioritized replay).  The priorities are kept
+// in a "sum-tree":  a binary tree whose leaves are the priorities and whose inner nodes
+// are the sums of their children, so sampling and updating are both O(log capacity).
+
+typedef struct
+	{
+	int K1[dimK];
+	int K2[dimK];
+	double R;
+	} TRANSITION;
+
+TRANSITION *replay = NULL;		// ring buffer
+double *sumTree = NULL;			// sumTree[1] = root, leaves at sumTree[capacity + i]
+int replayCapacity = 0;			// rounded up to a power of 2
+int replayHead = 0;				// next slot to be written
+int replaySize = 0;				// number of transitions stored
+double maxPriority = 1.0;		// new transitions get this priority, so they are seen soon
+
+#define PriorityAlpha	0.6		// 0 = uniform, 1 = fully proportional
+#define PriorityBeta	0.4		// importance-sampling correction, 1 = full correction
+#define PriorityEps		0.01	// so that no transition gets a zero probability
+
+void init_replay(int capacity)
+	{
+	int size = 1;
+	while (size < capacity)
+		size *= 2;
+
+	free(replay);
+	free(sumTree);
+	replay = (TRANSITION *) malloc(size * sizeof (TRANSITION));
+	sumTree = (double *) calloc(2 * size, sizeof (double));
+	replayCapacity = size;
+	replayHead = 0;
+	replaySize = 0;
+	maxPriority = 1.0;
+	}
+
+void setPriority(int i, double p)
+	{
+	int node = replayCapacity + i;
+	double change = pow(p, PriorityAlpha) - sumTree[node];
+	for (; node >= 1; node /= 2)
+		sumTree[node] += change;
+	}
+
+// Store a transition, overwriting the oldest one if the buffer is full
+void replay_push(int K1[dimK], int K2[dimK], double R)
+	{
+	TRANSITION *t = &replay[replayHead];
+	for (int k = 0; k < dimK; ++k)
+		{
+		t->K1[k] = K1[k];
+		t->K2[k] = K2[k];
+		}
+	t->R = R;
+	setPriority(replayHead, maxPriority);
+
+	replayHead = (replayHead + 1) % replayCapacity;
+	if (replaySize < replayCapacity)
+		++replaySize;
+	}
+
+// Draw B indices into the replay buffer (with replacement)
+// For prioritized sampling, weights receive the importance-sampling weights, normalized
+// so that the largest one is 1;  for uniform sampling they are all 1.
+void replay_sample(int B, bool prioritized, int index[], double weights[])
+	{
+	if (!prioritized)
+		{
+		for (int b = 0; b < B; ++b)
+			{
+			index[b] = rand() % replaySize;
+			weights[b] = 1.0;
+			}
+		return;
+		}
+
+	// Stratified sampling:  divide the total priority into B equal segments
+	double total = sumTree[1];
+	double maxWeight = 0.0;
+	for (int b = 0; b < B; ++b)
+		{
+		double x = (b + rand() / (RAND_MAX + 1.0)) * total / B;
+		int node = 1;
+		while (node < replayCapacity)			// descend to a leaf
+			{
+			if (x < sumTree[2 * node] || sumTree[2 * node + 1] <= 0.0)
+				node = 2 * node;
+			else
+				{
+				x -= sumTree[2 * node];
+				node = 2 * node + 1;
+				}
+			}
+		index[b] = node - replayCapacity;
+
+		double P = sumTree[node] / total;
+		weights[b] = pow(replaySize * P, -PriorityBeta);
+		if (weights[b] > maxWeight)
+			maxWeight = weights[b];
+		}
+	for (int b = 0; b < B; ++b)
+		weights[b] /= maxWeight;
+	}
+
+// (Part 2) Q-learning, from a mini-batch of B remembered transitions.
+// Same update as Q_learn(), ΔQ = η { R + γ max_a Q(K2,a) }, but:
+//	* the B max_a Q(K2,a) are found together, by one batched gradient ascent;
+//	* the B ΔQ's are applied in one batched back-prop (the mean of the B weight changes).
+void Q_learn_replay(int B, bool prioritized)
+	{
+	if (replaySize == 0)
+		return;
+
+	int index[B];
+	double weights[B];
+	replay_sample(B, prioritized, index, weights);
+
+	// Targets:  max_a Q(K2,a) for all B transitions, from random starting points
+	double *K1s = (double *) malloc(B * dimK * sizeof (double));
+	double *as = (double *) malloc(B * dimK * sizeof (double));
+	double *maxQs = (double *) malloc(B * sizeof (double));
+	for (int b = 0; b < B; ++b)
 		for (int k = 0; k < dimK; ++k)
 			{
-			// Create 2 copies of K2, whose k-th component is added / subtracted with δ
-			double K2plus[dimK], K2minus[dimK];
-			for (int k2 = 0; k2 < dimK; ++k2)
-				K2plus[k2] = K2minus[k2] = K2[k2];
-			K2plus[k] += delta;
-			K2minus[k] -= delta;
-
-			gradQ[k] = (getQ(K1, K2plus) - getQ(K1, K2minus)) / (2 * delta);
+			K1s[b * dimK + k] = (double) replay[index[b]].K2[k];
+			as[b * dimK + k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
 			}
+	ASCENT job = {targetNet(), K1s, dimK, as, maxQs, B};
+	ascendQ_batch(&job);
 
-		// Move a little along the gradient direction: K2 += -λ ∇Q
-		// (There seems to be a negative sign in the above formula)
-		#define Lambda	0.1
+	// Batched back-prop at the inputs (K1,K2)
+	double *K12 = (double *) malloc(B * dimK * 2 * sizeof (double));
+	double *dQ = (double *) malloc(B * sizeof (double));
+	for (int b = 0; b < B; ++b)
+		{
+		TRANSITION *t = &replay[index[b]];
 		for (int k = 0; k < dimK; ++k)
-			K2[k] += (-Lambda * gradQ[k]);
+			{
+			K12[b * dimK * 2 + k] = (double) t->K1[k];
+			K12[b * dimK * 2 + k + dimK] = (double) t->K2[k];
+			}
+		dQ[b] = Eta * (t->R + Gamma * maxQs[b]);
 
-		gradSize = norm(gradQ);
-		// printf("gradient norm = %f\r", gradSize);
-		++tries;
+		if (prioritized)
+			{
+			double p = fabs(dQ[b]) + PriorityEps;
+			setPriority(index[b], p);
+			if (p > maxPriority)
+				maxPriority = p;
+			}
+		dQ[b] *= weights[b] / B;
 		}
-	#define Epsilon 0.1
-	#define MaxTries 20000
-	while (gradSize > Epsilon && tries < MaxTries);
 
-	if (tries >= MaxTries)						// need to handle exception here
+	static BATCH *batch = NULL;
+	static NNET *batchNet = NULL;		// the net that the batch was made for
+	if (batch == NULL || batchNet != Qnet || batch->size < B)
 		{
-		printf("fail: ");
-		// The result in K2 may still be usable?
+		if (batch != NULL)
+			free_batch(batch);
+		batch = create_batch(Qnet, B);
+		batchNet = Qnet;
 		}
-
-	double result = getQ(K1, K2);
-	printf("%2.3f ", result);
-	plot_W(Qnet);
-	return result; // return Q value
+	forward_prop_sigmoid_batch(Qnet, batch, B, dimK * 2, K12);
+	back_prop_batch(Qnet, batch, B, dQ);
+	invalidate_incr(getQcache());
+	countUpdate();
+
+	free(dQ);
+	free(K12);
+	free(maxQs);
+	free(as);
+	free(K1s);
 	}
@@ -11,13 +11,13 @@ typedef struct LAYER
 	{
     NEURON *neurons;
     double alpha, beta, gamma, delta;		// The 4 distinct weights
+    double S, Q;			// Σx and Σx² of the layer's inputs, kept by forward-prop
 	} LAYER;
 
 //********************* struct for QNET ************************************//
 typedef struct QNET
 	{
     int numLayers;
+    int dim_V;				// dimension of input, output, and hidden layers, all the same
     LAYER *layers;
 	} QNET;					// neural network
-
-#define dim_V 4				// dimension of input, output, and hidden layers, all the same
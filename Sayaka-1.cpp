@@ -2,16 +2,19 @@
 #include <fstream>
 #include <sstream>		// for converting double to string
 #include <list>
-#include <map>
+#include <vector>
 #include <math.h>		// floor, nearbyint
+#include <algorithm>		// sort
+#include <functional>
+#include <ctime>			// clock
 #include "tic-tac-toe.h"
 
 using namespace std;
 
 extern State board;
 
-extern std::map<State, double, smaller> V1; // V1 is needed to train Q-net
-extern std::map<State, double, smaller> V2;
+extern VTable V1; // V1 is needed to train Q-net
+extern VTable V2;
 
 extern std::list<State> states1;
 extern std::list<State> states2;
@@ -30,6 +33,18 @@ extern "C" // Functions from Q-learning.c
 	void train_Q(int x[dimK], double v);
 	void Q_learn(int x[dimK], int y[dimK], double R);
 	double maxQ(int [dimK], double [dimK]);
+	double maxQ_multi(int [dimK], int, double [dimK], double *, double *, int);
+	void getQ_batch(double [dimK], int, double [], double []);
+	void init_replay(int capacity);
+	void replay_push(int K1[dimK], int K2[dimK], double R);
+	void Q_learn_replay(int B, bool prioritized);
+	void init_Qtarget(int syncEvery);
+	void save_Qstart(void);
+	void restore_Qstart(void);
+
+	// functions from visualization.c
+	void beep();
+	void bip();
 	}
 
 using namespace std;
@@ -38,21 +53,50 @@ using namespace std;
 extern void initBoard(void);
 extern bool updateBoard(int player, int index);
 extern int switchPlayer(int player);
-extern void getListOfBlankTiles(std::list<int> &blanks);
+extern unsigned getListOfBlankTiles(void);
 extern void printState(State board);
-extern int greedyMove(std::map<State, double, smaller> &V, int player);
+extern int greedyMove(VTable &V, int player);
 extern int computerMove(int player);
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int argmaxMove(int n, int moves[9], double values[9]);
 extern int hasWinner(void);
-extern void BellmanUpdate(State &s2, State &s, std::map<State, double, smaller> &V);
-extern int loadVFromFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V);
-extern void saveVToFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V);
+extern int hasWinner(const State &s);
+extern void BellmanUpdate(State &s2, State &s, VTable &V);
+extern int loadVFromFile(string filename, std::list<State> &states, VTable &V);
+extern void saveVToFile(string filename, std::list<State> &states, VTable &V);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+
+// ******** Functions from minimax.cpp
+extern double scoreMover(const char *name, int player, std::function<int ()> mover);
+
+// Score every legal move by Q(K1,K2), where K2 is the successor state, in one batched
+// forward propagation, and return the best one.  The board is not changed.
+int Q_greedyMoveSayaka1(const State &s)
+	{
+	int moves[9];
+	State next[9];
+	int n = legalMoves(s, 1, moves, next);
+
+	double K1[dimK], K2s[9 * dimK], Qs[9];
+	for (int k = 0; k < dimK; ++k)
+		K1[k] = (double) s.at(k);
+	for (int m = 0; m < n; ++m)
+		for (int k = 0; k < dimK; ++k)
+			K2s[m * dimK + k] = (double) next[m].at(k);
+
+	getQ_batch(K1, n, K2s, Qs);
+	return argmaxMove(n, moves, Qs);
+	}
+
+// Whether invalid optima are used to train the Q-net;  not while being scored
+static bool penalizeInvalid = true;
 
 // Original algorithm is to find max V amongst board positions.
 // Now we output the next move based on max_Q algorithm
 // 1. get current board position → K1
-// 2. find maxQ for K1, obtaining K2
-// 3. make move according to K2
-// 4. if move is invalid, train Qnet and re-try
+// 2. find maxQ for K1 from many random starts at once, obtaining local optima K2
+// 3. make move according to the best K2 that is a valid move
+// 4. every invalid K2 that scored higher is used to train Qnet
 
 int Q_moveSayaka1()
 	{
@@ -60,24 +104,33 @@ int Q_moveSayaka1()
 	int K_out[dimK];
 	double K2[dimK];
 
-	int tries = 25;
-	while (--tries > 0)				// Try gradient descent with restart
-		{
-		maxQ(board.x, K2); // we don't need the max Q value itself
+#   define NumStarts 25
+	double optima[NumStarts][dimK];
+	double Qs[NumStarts];
+	maxQ_multi(board.array().x, NumStarts, K2, &optima[0][0], Qs, 1);
+
+	// Try the local optima in order of decreasing Q value
+	int order[NumStarts];
+	for (int s = 0; s < NumStarts; ++s)
+		order[s] = s;
+	std::sort(order, order + NumStarts, [&Qs](int a, int b) { return Qs[a] > Qs[b]; });
 
+	for (int s = 0; s < NumStarts; ++s)
+		{
 		// convert K2 to closest integer
 		for (int k = 0; k < dimK; ++k)
-			K_out[k] = (int) nearbyint(K2[k]);
+			K_out[k] = (int) nearbyint(optima[order[s]][k]);
 
 		// Check if it is a valid successor state?
 		// Next state can only differ by 1 square and the difference must be a '0' → '1'
+		bestMove = -1;
 		for (int i = 0; i < 9; ++i)
 			{
-			if (board.x[i] != K_out[i])
+			if (board.at(i) != K_out[i])
 				{
 				if (bestMove != -1)
 					bestMove = -2;
-				else if (board.x[i] != 0)
+				else if (board.at(i) != 0)
 					bestMove = -2;
 				else if (K_out[i] != 1)
 					bestMove = -2;
@@ -89,23 +142,37 @@ int Q_moveSayaka1()
 		// cout << "Made greedy move...\n";
 
 		if (bestMove < 0)
-			Q_learn(board.x, K_out, -0.2);
+			{
+			if (penalizeInvalid)
+				Q_learn(board.array().x, K_out, -0.2);
+			}
 		else
 			break;
 		}
 
+	// None of the optima is a valid move, fall back on scoring the legal moves directly
+	if (bestMove < 0)
+		bestMove = Q_greedyMoveSayaka1(board);
+
 	return bestMove;
 	}
 
-extern "C" int tic_tac_toe_test3()
+// Score Q_moveSayaka1 against optimal play, without changing the Q-net
+double scoreSayaka1()
 	{
-	extern void beep();
-	extern void bip();
+	bool penalize = penalizeInvalid;
+	penalizeInvalid = false;
+	double score = scoreMover("Q_moveSayaka1", 1, Q_moveSayaka1);
+	penalizeInvalid = penalize;
+	return score;
+	}
 
+extern "C" int tic_tac_toe_test3()
+	{
 	// Read data for RL player 1 (Our learner)
 	cout << "Loading player 1's Q values...\n";
 	states1.clear();
-	int totalStates1 = loadVFromFile("ttt1.dat", states1, V1);
+	int totalStates1 = loadValues("ttt1", states1, V1);
 	cout << "Total read: " << to_string(totalStates1) << "\n";
 
 	//*** Train player1's Q network
@@ -138,8 +205,11 @@ extern "C" int tic_tac_toe_test3()
 
 				double v = V1.at(s);
 
-				// This needs to be changed:
-				train_Q(s.x, v);
+				// The Q-net plays on real boards, so it is trained on all the symmetric images of s
+				State images[NumSyms];
+				int numImages = orbit(s, images);
+				for (int g = 0; g < numImages; ++g)
+					train_Q(images[g].array().x, v);
 				}
 
 			double absError = 0.0; // sum of abs(error)
@@ -151,7 +221,7 @@ extern "C" int tic_tac_toe_test3()
 				double v = V1.at(s);
 				//cout << "v = " << to_string(v) << "\t";
 
-				double v2 = 0.0; // getQ(s.x);
+				double v2 = 0.0; // getQ(s.array().x);
 				//cout << "v2 = " << to_string(v2) << "\t";
 
 				double error = v - v2; // ideal - actual
@@ -160,7 +230,7 @@ extern "C" int tic_tac_toe_test3()
 				absError += fabs(error);
 				}
 			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / 8533.0);
+			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / totalStates1);
 
 			if (isnan(absError))
 				{
@@ -179,9 +249,7 @@ extern "C" int tic_tac_toe_test3()
 			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
 				{
 				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
+				int result = hasWinner(s);
 				double v;
 
 				if (result == -2)
@@ -192,7 +260,13 @@ extern "C" int tic_tac_toe_test3()
 					v = 1.0;
 
 				if (result != 0)
-					train_Q(s.x, v);
+					{
+					// The Q-net plays on real boards, so it is trained on all the symmetric images of s
+					State images[NumSyms];
+					int numImages = orbit(s, images);
+					for (int g = 0; g < numImages; ++g)
+						train_Q(images[g].array().x, v);
+					}
 				}
 
 			double absError = 0.0; // sum of abs(error)
@@ -200,12 +274,10 @@ extern "C" int tic_tac_toe_test3()
 			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
 				{
 				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
+				int result = hasWinner(s);
 				double v;
 
-				double v2 = 0.0; // get_Q(s.x);
+				double v2 = 0.0; // get_Q(s.array().x);
 				//cout << "v2 = " << to_string(v2) << "\t";
 
 				if (result == -2)
@@ -224,7 +296,7 @@ extern "C" int tic_tac_toe_test3()
 				absError += fabs(error);
 				}
 			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / 8533.0);
+			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / totalStates1);
 
 			if (isnan(absError))
 				{
@@ -239,9 +311,28 @@ extern "C" int tic_tac_toe_test3()
 	// Build states for RL player -1 ("Computer player")
 	cout << "\n\nLoading player -1...\n";
 	states2.clear();
-	int totalStates2 = loadVFromFile("ttt2.dat", states2, V2);
+	int totalStates2 = loadValues("ttt2", states2, V2);
 	cout << "Total read: " << to_string(totalStates2) << "\n";
 
+	// **** Target network for the Q-learning targets, to compare games-to-convergence
+	cout << "\nUse target network for Q-learning targets? [y/n]\n";
+	do
+		key = getchar();
+	while (key == '\n');
+	#define TargetSyncEvery		500		// Q_learn updates between syncs
+	init_Qtarget(key == 'y' ? TargetSyncEvery : 0);
+
+	// Convergence is measured against the minimax oracle, because the win rates against V2
+	// stay at a few percent:  after every block of games, the learner's moves are scored in
+	// all positions.  Games to convergence = the games after which the fraction of optimal
+	// moves stays within ConvergedBand of its final value.
+	#define ConvergenceBlock	500		// games per block
+	#define ConvergedBand		0.01
+	int blockWins = 0;
+	vector<double> blockScores;
+	printf("games      0: ");
+	scoreSayaka1();
+
 #    define totalGames 100000
 	int playTimes = 0;
 	int numPlayer1Won = 0;
@@ -268,9 +359,8 @@ extern "C" int tic_tac_toe_test3()
 
 		while (true) // Loop over 1 single game
 			{
-			std::list<int> nextMoves;
-			getListOfBlankTiles(nextMoves);
-			int countNextMoves = nextMoves.size();
+			unsigned nextMoves = getListOfBlankTiles();
+			int countNextMoves = __builtin_popcount(nextMoves);
 
 			// cout << "Move of player: " << to_string(player) << "\n";
 
@@ -286,9 +376,7 @@ extern "C" int tic_tac_toe_test3()
 					{
 					// generate random # within range of possible moves
 					int move = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
-					std::list<int>::iterator it = nextMoves.begin();
-					std::advance(it, move);
-					userMove = *it;
+					userMove = nthSquare(nextMoves, move);
 					//cout << "Exploring move = " << to_string(userMove) << "\n";
 					updateBoard(player, userMove);
 					prev_s_1 = board;
@@ -322,11 +410,9 @@ extern "C" int tic_tac_toe_test3()
 						{
 						int moveIndex = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
 						//cout << "Exploring move = " << to_string(move) << "\n";
-						std::list<int>::iterator it = nextMoves.begin();
-						std::advance(it, moveIndex);
-						userMove = *it;
+						userMove = nthSquare(nextMoves, moveIndex);
 						updateBoard(player, userMove);
-						Q_learn(prev_s1.x, board.x, 0.5);
+						Q_learn(prev_s1.array().x, board.array().x, 0.5);
 						prev_s1 = board;
 						break;
 						}
@@ -338,7 +424,7 @@ extern "C" int tic_tac_toe_test3()
 							{
 							++ourMoves1K;
 							updateBoard(player, userMove);
-							Q_learn(prev_s1.x, board.x, 0.8);
+							Q_learn(prev_s1.array().x, board.array().x, 0.8);
 							prev_s1 = board;
 							// printf("move made\n");
 							break;
@@ -354,8 +440,8 @@ extern "C" int tic_tac_toe_test3()
 			if (won == -2) // draw
 				{
 				numDraws++;
-				// train_Q(board.x, 0.0);
-				Q_learn(prev_s1.x, board.x, 0.5);
+				// train_Q(board.array().x, 0.0);
+				Q_learn(prev_s1.array().x, board.array().x, 0.5);
 				// printf("-");
 				break;
 				}
@@ -366,10 +452,11 @@ extern "C" int tic_tac_toe_test3()
 					{
 					++ourWins1K;
 					++numPlayer1Won;
+					++blockWins;
 					// max_s_1 = board;
 					// BellmanUpdate(max_s2, prev_s2, V2);
-					// train_Q(max_s_1.x, 10.0);
-					Q_learn(prev_s1.x, board.x, 10.0);
+					// train_Q(max_s_1.array().x, 10.0);
+					Q_learn(prev_s1.array().x, board.array().x, 10.0);
 					// cout << "V2(s) changed from " << to_string(V2[prev_s2]);
 					// cout << "to " << to_string(V2[prev_s2]);
 					}
@@ -377,8 +464,8 @@ extern "C" int tic_tac_toe_test3()
 					{
 					++numPlayer_1Won;
 					// max_s1 = board;
-					// train_Q(max_s1.x, -0.7);
-					Q_learn(prev_s1.x, board.x, -0.3);
+					// train_Q(max_s1.array().x, -0.7);
+					Q_learn(prev_s1.array().x, board.array().x, -0.3);
 					}
 
 				// printf(player == 1 ? "█" : " ");
@@ -392,6 +479,12 @@ extern "C" int tic_tac_toe_test3()
 		// Next game...
 		++playTimes;
 		// fflush(stdout);
+		if ((playTimes % ConvergenceBlock) == 0)
+			{
+			printf("games %6d: block win rate %2.1f%%, ", playTimes, blockWins * 100.0 / ConvergenceBlock);
+			blockScores.push_back(scoreSayaka1());
+			blockWins = 0;
+			}
 		if ((playTimes % 1000) == 0)
 			{
 			printf("per 1K wins = %d (%2.1f%%)", ourWins1K, ((float) ourWins1K) / 1000.0 * 100.0);
@@ -417,8 +510,165 @@ extern "C" int tic_tac_toe_test3()
 	printf("Genifer (1) wins %d (%2.1f%%)\n", numPlayer1Won, ((float) numPlayer1Won) / totalGames * 100.0);
 	printf("Player (-1) Wins %d (%2.1f%%)\n", numPlayer_1Won, ((float) numPlayer_1Won) / totalGames * 100.0);
 	printf("           Draws %d (%2.1f%%)\n", numDraws, ((float) numDraws) / totalGames * 100.0);
+	if (!blockScores.empty())
+		{
+		double finalScore = blockScores.back();
+		int convergedAt = ConvergenceBlock;
+		for (size_t b = 0; b < blockScores.size(); ++b)
+			if (fabs(blockScores[b] - finalScore) > ConvergedBand)
+				convergedAt = (b + 2) * ConvergenceBlock;
+		printf("Games to convergence = %d (%.1f%% optimal moves, ±%.0f%%)\n", convergedAt,
+			finalScore * 100.0, ConvergedBand * 100.0);
+		}
+
+	scoreSayaka1();
 
 	beep();
 	return 0;
 	}
 
+
+// **** Benchmark:  learning from each transition directly (Q_learn), versus learning from
+// mini-batches of the replay memory, uniform or prioritized.
+// Genifer (1) plays BenchGames games against the static greedy V2 player (-1), with the same
+// rewards as tic_tac_toe_test3.  For each method we report:
+//	* throughput = transitions back-propagated per second of learning time
+//	* sample efficiency = win rate per block of 500 games, and the number of games until
+//	  a block first reaches TargetWinRate
+enum { LearnDirect, LearnUniform, LearnPrioritized };
+
+int learnMethod;
+long transitionsLearned;
+long replayPushes;
+double learnTime;
+
+void learnTransition(int K1[dimK], int K2[dimK], double R)
+	{
+	#define ReplayCapacity	10000
+	#define ReplayBatch		32
+	#define ReplayEvery		8		// 1 batched update per 8 new transitions
+
+	clock_t start = clock();
+	if (learnMethod == LearnDirect)
+		{
+		Q_learn(K1, K2, R);
+		++transitionsLearned;
+		}
+	else
+		{
+		replay_push(K1, K2, R);
+		if (++replayPushes % ReplayEvery == 0)
+			{
+			Q_learn_replay(ReplayBatch, learnMethod == LearnPrioritized);
+			transitionsLearned += ReplayBatch;
+			}
+		}
+	learnTime += (clock() - start) / (double) CLOCKS_PER_SEC;
+	}
+
+// Play 1 game, returns the winner (1 or -1) or 0 for a draw
+int benchmarkGame()
+	{
+	initBoard();
+	int player = ((rand() / (double) RAND_MAX) > 0.5) ? 1 : -1;
+	State prev_s1 = State();
+
+	while (true)
+		{
+		unsigned nextMoves = getListOfBlankTiles();
+		int countNextMoves = __builtin_popcount(nextMoves);
+
+		double ex = (rand() / (double) RAND_MAX); // explore or not?
+		int userMove;
+		bool explored = (ex <= 0.1);
+		if (explored)
+			{
+			int moveIndex = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
+			userMove = nthSquare(nextMoves, moveIndex);
+			}
+		else if (player == -1)
+			userMove = greedyMove(V2, player);
+		else
+			userMove = Q_moveSayaka1();
+		updateBoard(player, userMove);
+
+		if (player == 1)
+			{
+			learnTransition(prev_s1.array().x, board.array().x, explored ? 0.5 : 0.8);
+			prev_s1 = board;
+			}
+
+		int won = hasWinner();
+		if (won == -2)						// draw
+			{
+			learnTransition(prev_s1.array().x, board.array().x, 0.5);
+			return 0;
+			}
+		if (won != 0)
+			{
+			learnTransition(prev_s1.array().x, board.array().x, (player == 1) ? 10.0 : -0.3);
+			return player;
+			}
+		player = switchPlayer(player);
+		}
+	}
+
+extern "C" void Q_replay_benchmark()
+	{
+	cout << "Loading player -1...\n";
+	states2.clear();
+	int totalStates2 = loadValues("ttt2", states2, V2);
+	cout << "Total read: " << to_string(totalStates2) << "\n";
+
+	#define BenchGames		5000
+	#define BlockGames		500
+	#define TargetWinRate	0.05
+	const char *names[] = {"direct Q_learn", "uniform replay", "prioritized replay"};
+
+	// Every transition must go through learnTransition(), so Q_moveSayaka1 may not learn
+	// from its invalid moves on its own
+	bool penalize = penalizeInvalid;
+	penalizeInvalid = false;
+
+	init_Qnet();
+	save_Qstart();						// every method starts from the same net
+
+	for (int method = LearnDirect; method <= LearnPrioritized; ++method)
+		{
+		restore_Qstart();
+		init_Qtarget(0);				// no method inherits a target net
+		srand(12345);					// same games for every method
+		init_replay(ReplayCapacity);
+		learnMethod = method;
+		transitionsLearned = 0;
+		replayPushes = 0;
+		learnTime = 0.0;
+
+		printf("\n**** %s\n", names[method]);
+		int wins = 0, gamesToTarget = -1;
+		for (int g = 1; g <= BenchGames; ++g)
+			{
+			if (benchmarkGame() == 1)
+				++wins;
+			if (g % BlockGames == 0)
+				{
+				double rate = wins / (double) BlockGames;
+				printf("games %5d: win rate %2.1f%%\n", g, rate * 100.0);
+				if (gamesToTarget < 0 && rate >= TargetWinRate)
+					gamesToTarget = g;
+				wins = 0;
+				}
+			}
+
+		printf("transitions learned = %ld, %.0f per second\n",
+				transitionsLearned, transitionsLearned / learnTime);
+		if (gamesToTarget > 0)
+			printf("games to reach %2.0f%% wins = %d\n", TargetWinRate * 100.0, gamesToTarget);
+		else
+			printf("did not reach %2.0f%% wins\n", TargetWinRate * 100.0);
+		scoreSayaka1();
+		}
+
+	penalizeInvalid = penalize;
+	beep();
+	}
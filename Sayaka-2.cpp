@@ -5,16 +5,18 @@
 #include <fstream>
 #include <sstream>		// for converting double to string
 #include <list>
-#include <map>
+#include <vector>
 #include <math.h>		// floor, nearbyint
+#include <algorithm>		// sort
+#include <functional>
 #include "tic-tac-toe.h"
 
 using namespace std;
 
 extern State board;
 
-extern std::map<State, double, smaller> V1; // V1 is needed to train Q-net
-extern std::map<State, double, smaller> V2;
+extern VTable V1; // V1 is needed to train Q-net
+extern VTable V2;
 
 extern std::list<State> states1;
 extern std::list<State> states2;
@@ -33,6 +35,9 @@ extern "C" // Functions from Q-learning.c
 	void train_Q(int x[dimK], double v);
 	void Q_learn(int x[dimK], int y[dimK], double R);
 	double maxQ(int [dimK], double [dimK]);
+	double maxQ_multi(int [dimK], int, double [dimK], double *, double *, int);
+	void getQ_batch(double [dimK], int, double [], double []);
+	void init_Qtarget(int syncEvery);
 
 	// functions from visualization.c
 	extern int  delay_vis(int);
@@ -45,21 +50,50 @@ using namespace std;
 extern void initBoard(void);
 extern bool updateBoard(int player, int index);
 extern int switchPlayer(int player);
-extern void getListOfBlankTiles(std::list<int> &blanks);
+extern unsigned getListOfBlankTiles(void);
 extern void printState(State board);
-extern int greedyMove(std::map<State, double, smaller> &V, int player);
+extern int greedyMove(VTable &V, int player);
 extern int computerMove(int player);
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int argmaxMove(int n, int moves[9], double values[9]);
 extern int hasWinner(void);
-extern void BellmanUpdate(State &s2, State &s, std::map<State, double, smaller> &V);
-extern int loadVFromFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V);
-extern void saveVToFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V);
+extern int hasWinner(const State &s);
+extern void BellmanUpdate(State &s2, State &s, VTable &V);
+extern int loadVFromFile(string filename, std::list<State> &states, VTable &V);
+extern void saveVToFile(string filename, std::list<State> &states, VTable &V);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+
+// ******** Functions from minimax.cpp
+extern double scoreMover(const char *name, int player, std::function<int ()> mover);
+
+// Score every legal move by Q(K1,K2), where K2 is the move as a one-hot "action" vector,
+// in one batched forward propagation, and return the best one.  The board is not changed.
+int Q_greedyMoveSayaka2(const State &s)
+	{
+	int moves[9];
+	State next[9];
+	int n = legalMoves(s, 1, moves, next);
+
+	double K1[dimK], K2s[9 * dimK], Qs[9];
+	for (int k = 0; k < dimK; ++k)
+		K1[k] = (double) s.at(k);
+	for (int m = 0; m < n; ++m)
+		for (int k = 0; k < dimK; ++k)
+			K2s[m * dimK + k] = (k == moves[m]) ? 1.0 : 0.0;
+
+	getQ_batch(K1, n, K2s, Qs);
+	return argmaxMove(n, moves, Qs);
+	}
+
+// Whether invalid optima are used to train the Q-net;  not while being scored
+static bool penalizeInvalid = true;
 
 // Original algorithm is to find max V amongst board positions.
 // Now we output the next move based on max_Q algorithm
 // 1. get current board position → K1
-// 2. find maxQ for K1, obtaining K2
-// 3. make move according to K2
-// 4. if move is invalid, train Qnet and re-try
+// 2. find maxQ for K1 from many random starts at once, obtaining local optima K2
+// 3. make move according to the best K2 that is a valid move
+// 4. every invalid K2 that scored higher is used to train Qnet
 
 int Q_moveSayaka2()
 	{
@@ -67,39 +101,61 @@ int Q_moveSayaka2()
 	int K_out[dimK];
 	double K2[dimK];
 
+#   define NumStarts 50
+	double optima[NumStarts][dimK];
+	double Qs[NumStarts];
+	maxQ_multi(board.array().x, NumStarts, K2, &optima[0][0], Qs, 1);
+
+	// Try the local optima in order of decreasing Q value
+	int order[NumStarts];
+	for (int s = 0; s < NumStarts; ++s)
+		order[s] = s;
+	std::sort(order, order + NumStarts, [&Qs](int a, int b) { return Qs[a] > Qs[b]; });
+
 	int tries = 0;
-#   define MaxTries 50
-	while (tries++ < MaxTries)				// Try gradient descent with restart
+	while (tries < NumStarts)
 		{
-		maxQ(board.x, K2);			// we don't need the max Q value itself
+		double *K2 = optima[order[tries++]];
 
 		// Find max element in K2, its index would be the move #
+		int move = 0;
 		double max = -1000000.0;
 		for (int k = 0; k < dimK; ++k)
 			if (K2[k] > max)
-				max = K2[k], bestMove = k;
+				max = K2[k], move = k;
 
 		// Is the move valid?
-		if (board.x[bestMove] != 0)
-			bestMove = -1;				// square is already occupied
-
-		// cout << "Made greedy move...\n";
-
-		if (bestMove < 0)
+		if (board.at(move) != 0)			// square is already occupied
 			{
 			for (int k = 0; k < dimK; ++k)
-				K_out[k] = ((k == bestMove) ? 1 : 0);
-			Q_learn(board.x, K_out, -0.1);
+				K_out[k] = ((k == move) ? 1 : 0);
+			if (penalizeInvalid)
+				Q_learn(board.array().x, K_out, -0.1);
 			}
 		else
 			{
-			// printf("best move = %d\n", bestMove);
+			// printf("best move = %d\n", move);
+			bestMove = move;
 			break;
 			}
 		}
 
+	// None of the optima is a valid move, fall back on scoring the legal moves directly
+	if (bestMove < 0)
+		bestMove = Q_greedyMoveSayaka2(board);
+
 	printf("(%d tries) ", tries);
-	return bestMove;						// returns -1 if fail to find valid move
+	return bestMove;
+	}
+
+// Score Q_moveSayaka2 against optimal play, without changing the Q-net
+double scoreSayaka2()
+	{
+	bool penalize = penalizeInvalid;
+	penalizeInvalid = false;
+	double score = scoreMover("Q_moveSayaka2", 1, Q_moveSayaka2);
+	penalizeInvalid = penalize;
+	return score;
 	}
 
 extern "C" int tic_tac_toe_test4()
@@ -109,7 +165,7 @@ extern "C" int tic_tac_toe_test4()
 	// Read data for RL player 1 (Our learner)
 	cout << "Loading player 1's Q values...\n";
 	states1.clear();
-	int totalStates1 = loadVFromFile("ttt1.dat", states1, V1);
+	int totalStates1 = loadValues("ttt1", states1, V1);
 	cout << "Total read: " << to_string(totalStates1) << "\n";
 
 	//*** Train player1's Q network
@@ -142,8 +198,11 @@ extern "C" int tic_tac_toe_test4()
 
 				double v = V1.at(s);
 
-				// This needs to be changed:
-				train_Q(s.x, v);
+				// The Q-net plays on real boards, so it is trained on all the symmetric images of s
+				State images[NumSyms];
+				int numImages = orbit(s, images);
+				for (int g = 0; g < numImages; ++g)
+					train_Q(images[g].array().x, v);
 				}
 
 			double absError = 0.0; // sum of abs(error)
@@ -155,7 +214,7 @@ extern "C" int tic_tac_toe_test4()
 				double v = V1.at(s);
 				//cout << "v = " << to_string(v) << "\t";
 
-				double v2 = 0.0; // getQ(s.x);
+				double v2 = 0.0; // getQ(s.array().x);
 				//cout << "v2 = " << to_string(v2) << "\t";
 
 				double error = v - v2; // ideal - actual
@@ -164,7 +223,7 @@ extern "C" int tic_tac_toe_test4()
 				absError += fabs(error);
 				}
 			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / 8533.0);
+			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / totalStates1);
 
 			if (isnan(absError))
 				{
@@ -183,9 +242,7 @@ extern "C" int tic_tac_toe_test4()
 			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
 				{
 				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
+				int result = hasWinner(s);
 				double v;
 
 				if (result == -2)
@@ -196,7 +253,13 @@ extern "C" int tic_tac_toe_test4()
 					v = 1.0;
 
 				if (result != 0)
-					train_Q(s.x, v);
+					{
+					// The Q-net plays on real boards, so it is trained on all the symmetric images of s
+					State images[NumSyms];
+					int numImages = orbit(s, images);
+					for (int g = 0; g < numImages; ++g)
+						train_Q(images[g].array().x, v);
+					}
 				}
 
 			double absError = 0.0; // sum of abs(error)
@@ -204,16 +267,14 @@ extern "C" int tic_tac_toe_test4()
 			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
 				{
 				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
+				int result = hasWinner(s);
 				double v;
 
 				double x1[dimK], x2[dimK];
 
 				for (int k = 0; k < dimK; ++k)
 					{
-					x1[k] = (double) s.x[k];
+					x1[k] = (double) s.at(k);
 
 					// 2nd argument is random
 					x2[k] = (rand() / (float) RAND_MAX) * 2.0 - 1.0; // in [+1,-1]
@@ -238,7 +299,7 @@ extern "C" int tic_tac_toe_test4()
 				absError += fabs(error);
 				}
 			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\n", absError, absError / 8533.0);
+			printf("∑ abs err = %.1f (avg = %.3f)\n", absError, absError / totalStates1);
 
 			if (isnan(absError))
 				{
@@ -253,10 +314,29 @@ extern "C" int tic_tac_toe_test4()
 	// Build states for RL player -1 ("Computer player")
 	cout << "\n\nLoading player -1...\n";
 	states2.clear();
-	int totalStates2 = loadVFromFile("ttt2.dat", states2, V2);
+	int totalStates2 = loadValues("ttt2", states2, V2);
 	cout << "Total read: " << to_string(totalStates2) << "\n";
 
-#   define totalGames 100
+	// **** Target network for the Q-learning targets, to compare games-to-convergence
+	cout << "\nUse target network for Q-learning targets? [y/n]\n";
+	do
+		key = getchar();
+	while (key == '\n');
+	#define TargetSyncEvery		500		// Q_learn updates between syncs
+	init_Qtarget(key == 'y' ? TargetSyncEvery : 0);
+
+	// Convergence is measured against the minimax oracle, because the win rates against V2
+	// stay at a few percent:  after every block of games, the learner's moves are scored in
+	// all positions.  Games to convergence = the games after which the fraction of optimal
+	// moves stays within ConvergedBand of its final value.
+	#define ConvergenceBlock	1000	// games per block
+	#define ConvergedBand		0.02	// Q_moveSayaka2 has random starts, so its score is noisier
+	int blockWins = 0;
+	vector<double> blockScores;
+	printf("games      0: ");
+	scoreSayaka2();
+
+#   define totalGames 20000
 	int playTimes = 0;
 	int numPlayer1Won = 0;
 	int numPlayer_1Won = 0;
@@ -276,16 +356,15 @@ extern "C" int tic_tac_toe_test4()
 		// printState(board);
 
 		State prev_s1 = State();		// initialized as state "0"
-		State prev_move1 = State();		// not really a "state", just for storing the move index
+		Board prev_move1 = {};			// not a state, just the one-hot move index
 
 		State prev_s_1 = State();
 		State max_s_1 = State();
 
 		while (true) // Loop over 1 single game
 			{
-			std::list<int> nextMoves;
-			getListOfBlankTiles(nextMoves);
-			int countNextMoves = nextMoves.size();
+			unsigned nextMoves = getListOfBlankTiles();
+			int countNextMoves = __builtin_popcount(nextMoves);
 
 			// cout << "Move of player: " << to_string(player) << "\n";
 
@@ -301,9 +380,7 @@ extern "C" int tic_tac_toe_test4()
 					{
 					// generate random # within range of possible moves
 					int move = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
-					std::list<int>::iterator it = nextMoves.begin();
-					std::advance(it, move);
-					userMove = *it;
+					userMove = nthSquare(nextMoves, move);
 					//cout << "Exploring move = " << to_string(userMove) << "\n";
 					updateBoard(player, userMove);
 					prev_s_1 = board;
@@ -337,12 +414,10 @@ extern "C" int tic_tac_toe_test4()
 						{
 						int moveIndex = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
 						//cout << "Exploring move = " << to_string(move) << "\n";
-						std::list<int>::iterator it = nextMoves.begin();
-						std::advance(it, moveIndex);
-						userMove = *it;
+						userMove = nthSquare(nextMoves, moveIndex);
 						for (int k = 0; k < 9; ++k)
 							prev_move1.x[k] = (userMove == k) ? 1 : 0;
-						Q_learn(board.x, prev_move1.x, 0.4);
+						Q_learn(board.array().x, prev_move1.x, 0.4);
 						updateBoard(player, userMove);
 						// prev_s1 = board;
 						break;
@@ -356,7 +431,7 @@ extern "C" int tic_tac_toe_test4()
 							++ourMoves1K;
 							for (int k = 0; k < 9; ++k)
 								prev_move1.x[k] = (userMove == k) ? 1 : 0;
-							Q_learn(board.x, prev_move1.x, 0.6);
+							Q_learn(board.array().x, prev_move1.x, 0.6);
 							updateBoard(player, userMove);
 							// prev_s1 = board;
 							// prev_move1 = userMove;
@@ -374,8 +449,8 @@ extern "C" int tic_tac_toe_test4()
 			if (won == -2) // draw
 				{
 				numDraws++;
-				// train_Q(board.x, 0.0);
-				Q_learn(board.x, prev_move1.x, 0.5);
+				// train_Q(board.array().x, 0.0);
+				Q_learn(board.array().x, prev_move1.x, 0.5);
 				printf("-");
 				break;
 				}
@@ -386,10 +461,11 @@ extern "C" int tic_tac_toe_test4()
 					{
 					++ourWins1K;
 					++numPlayer1Won;
+					++blockWins;
 					// BellmanUpdate(max_s2, prev_s2, V2);
 					// Still unsolved - need to train over all prev states:
-					// train_Q(max_s_1.x, 10.0);
-					Q_learn(board.x, prev_move1.x, 0.95);
+					// train_Q(max_s_1.array().x, 10.0);
+					Q_learn(board.array().x, prev_move1.x, 0.95);
 					// cout << "V2(s) changed from " << to_string(V2[prev_s2]);
 					// cout << "to " << to_string(V2[prev_s2]);
 					}
@@ -397,8 +473,8 @@ extern "C" int tic_tac_toe_test4()
 					{
 					++numPlayer_1Won;
 					// Still unsolved - need to train over all prev states:
-					// train_Q(max_s1.x, -0.7);
-					Q_learn(board.x, prev_move1.x, -0.2);
+					// train_Q(max_s1.array().x, -0.7);
+					Q_learn(board.array().x, prev_move1.x, -0.2);
 					}
 
 				printf(player == 1 ? "█" : " ");
@@ -416,6 +492,12 @@ extern "C" int tic_tac_toe_test4()
 		// Next game...
 		++playTimes;
 		// fflush(stdout);
+		if ((playTimes % ConvergenceBlock) == 0)
+			{
+			printf("games %6d: block win rate %2.1f%%, ", playTimes, blockWins * 100.0 / ConvergenceBlock);
+			blockScores.push_back(scoreSayaka2());
+			blockWins = 0;
+			}
 		if ((playTimes % 1000) == 0)
 			{
 			printf("per 1K wins = %d (%2.1f%%)", ourWins1K, ((float) ourWins1K) / 1000.0 * 100.0);
@@ -440,6 +522,18 @@ extern "C" int tic_tac_toe_test4()
 	printf("Genifer (1) wins %d (%2.1f%%)\n", numPlayer1Won, ((float) numPlayer1Won) / totalGames * 100.0);
 	printf("Player (-1) Wins %d (%2.1f%%)\n", numPlayer_1Won, ((float) numPlayer_1Won) / totalGames * 100.0);
 	printf("           Draws %d (%2.1f%%)\n", numDraws, ((float) numDraws) / totalGames * 100.0);
+	if (!blockScores.empty())
+		{
+		double finalScore = blockScores.back();
+		int convergedAt = ConvergenceBlock;
+		for (size_t b = 0; b < blockScores.size(); ++b)
+			if (fabs(blockScores[b] - finalScore) > ConvergedBand)
+				convergedAt = (b + 2) * ConvergenceBlock;
+		printf("Games to convergence = %d (%.1f%% optimal moves, ±%.0f%%)\n", convergedAt,
+			finalScore * 100.0, ConvergedBand * 100.0);
+		}
+
+	scoreSayaka2();
 
 	beep();
 	pause_graphics();
@@ -16,6 +16,14 @@ extern NNET *create_NN(int numberOfLayers, int *neuronsPerLayer);
 extern void forward_prop_sigmoid(NNET *, int, double *);
 extern double calc_error(NNET *net, double *Y);
 extern void back_prop(NNET *, double *errors);
+extern BATCH *create_batch(NNET *, int);
+extern void free_batch(BATCH *);
+extern void forward_prop_sigmoid_batch(NNET *, BATCH *, int, int, double *);
+extern void back_prop_batch(NNET *, BATCH *, int, double *errors);
+extern INCR *create_incr(NNET *);
+extern void free_incr(INCR *);
+extern void invalidate_incr(INCR *);
+extern void forward_prop_sigmoid_incr(NNET *, INCR *, int, double *);
 
 //************************** prepare Q-net ***********************//
 NNET *Vnet;
@@ -23,6 +31,21 @@ NNET *Vnet;
 int VnumLayers = 5;
 int VneuronsPerLayer[] = {9, 40, 30, 20, 1};		// success
 
+// Cache for incremental evaluation in get_V(), since successive boards usually differ
+// in only 1 or 2 squares.  It must be invalidated whenever Vnet's weights change.
+INCR *Vcache = NULL;
+
+INCR *getVcache()
+	{
+	if (Vcache == NULL || Vcache->net != Vnet)
+		{
+		if (Vcache != NULL)
+			free_incr(Vcache);
+		Vcache = create_incr(Vnet);
+		}
+	return Vcache;
+	}
+
 void init_Vnet()
 	{
 	//the first layer -- input layer
@@ -32,6 +55,7 @@ void init_Vnet()
 	Vnet = (NNET*) malloc(sizeof (NNET));
 	//create neural network for backpropagation
 	Vnet = create_NN(VnumLayers, VneuronsPerLayer);
+	invalidate_incr(getVcache());
 
 	// return Vnet;
 	}
@@ -42,6 +66,7 @@ void load_Vnet()
 	int *neuronsPerLayer2;
 	extern NNET * loadNet(int *, int *p[], char *);
 	Vnet = loadNet(&numLayers2, &neuronsPerLayer2, "v.net");
+	invalidate_incr(getVcache());
 	// LAYER lastLayer = Vnet->layers[numLayers - 1];
 
 	return;
@@ -77,6 +102,68 @@ void train_V(int s[9], double V)
 
 		back_prop(Vnet, error);
 		}
+	invalidate_incr(getVcache());
+	}
+
+// **** Learn V(x_i) = v_i for n boards, 1 epoch of mini-batches.
+// X is the n × 9 matrix of boards, packed once by the caller.  Each epoch visits the
+// boards in a new random order, in mini-batches of batchSize with 1 batched back-prop each.
+// Returns ∑ abs(error) over the epoch, taken from the training forward passes themselves
+// (ie, before each batch's update), so no second sweep over the boards is needed.
+
+double train_V_epoch(int n, double X[], double V[], int batchSize)
+	{
+	static BATCH *batch = NULL;
+	static NNET *batchNet = NULL;
+	static int *order = NULL;
+	static int orderSize = 0;
+	if (batch == NULL || batchNet != Vnet || batch->size < batchSize)
+		{
+		if (batch != NULL)
+			free_batch(batch);
+		batch = create_batch(Vnet, batchSize);
+		batchNet = Vnet;
+		}
+	if (orderSize < n)
+		{
+		order = (int *) realloc(order, n * sizeof (int));
+		orderSize = n;
+		}
+
+	// Fisher-Yates shuffle
+	for (int i = 0; i < n; ++i)
+		order[i] = i;
+	for (int i = n - 1; i > 0; --i)
+		{
+		int j = rand() % (i + 1);
+		int t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+		}
+
+	int numLayers = 5;
+	double S[batchSize * 9], error[batchSize];
+	double absError = 0.0;
+	for (int start = 0; start < n; start += batchSize)
+		{
+		int rows = (n - start < batchSize) ? n - start : batchSize;
+		for (int b = 0; b < rows; ++b)
+			for (int k = 0; k < 9; ++k)
+				S[b * 9 + k] = X[order[start + b] * 9 + k];
+
+		forward_prop_sigmoid_batch(Vnet, batch, rows, 9, S);
+
+		// The last layer has only 1 neuron, which outputs the V value:
+		for (int b = 0; b < rows; ++b)
+			{
+			error[b] = V[order[start + b]] - batch->outputs[numLayers - 1][b]; // desired - actual
+			absError += fabs(error[b]);
+			}
+
+		back_prop_batch(Vnet, batch, rows, error);
+		}
+	invalidate_incr(getVcache());
+	return absError;
 	}
 
 // **** Learn a simple V-value map via backprop and Bellman update
@@ -109,9 +196,10 @@ void learn_V(int s2[9], int s[9])
 
 		back_prop(Vnet, error);
 		}
+	invalidate_incr(getVcache());
 	}
 
-// Get V-value by forward propagation
+// Get V-value by (incremental) forward propagation
 
 double get_V(int x[9])
 	{
@@ -119,10 +207,38 @@ double get_V(int x[9])
 	for (int k = 0; k < 9; ++k)
 		X[k] = (double) x[k];
 
-	forward_prop_sigmoid(Vnet, 9, X);
+	forward_prop_sigmoid_incr(Vnet, getVcache(), 9, X);
 
 	int numLayers = 5;
 	LAYER LastLayer = (Vnet->layers[numLayers - 1]);
 	// The last layer has only 1 neuron, which outputs the Q value:
 	return LastLayer.neurons[0].output;
 	}
+
+// Get V-values of n board states in one batched forward propagation.
+// Typically these are all the successor states of a board position (n ≤ 9).
+
+void get_V_batch(int n, int x[][9], double v[])
+	{
+	static BATCH *batch = NULL;
+	static NNET *batchNet = NULL;		// the net that the batch was made for
+	if (batch == NULL || batchNet != Vnet || batch->size < n)
+		{
+		if (batch != NULL)
+			free_batch(batch);
+		batch = create_batch(Vnet, n > 9 ? n : 9);
+		batchNet = Vnet;
+		}
+
+	double X[n * 9];
+	for (int i = 0; i < n; ++i)
+		for (int k = 0; k < 9; ++k)
+			X[i * 9 + k] = (double) x[i][k];
+
+	forward_prop_sigmoid_batch(Vnet, batch, n, 9, X);
+
+	int numLayers = 5;
+	// The last layer has only 1 neuron, which outputs the V value:
+	for (int i = 0; i < n; ++i)
+		v[i] = batch->outputs[numLayers - 1][i];
+	}
@@ -0,0 +1,234 @@
+// V-value tables of tic-tac-toe:  the symmetry classes of boards, and reading / writing
+// the tables in the old text format (ttt*.dat) and in a binary format (ttt*.vtb).
+
+// **** Binary format:
+//	header:  "TTTV", version, number of entries (NumCanon), bytes per entry
+//	then the values of all the canonical boards, as doubles indexed by canonTable.id[],
+//	with NaN for the boards that have no value.
+// The file is loaded with mmap, and written to a temporary file that is renamed over the
+// old one, so readers never see a half-written table.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>		// for converting double to string
+#include <list>
+#include <string>
+#include <cstring>		// memcmp
+#include <math.h>		// NAN, isnan
+#include <assert.h>
+#include <fcntl.h>		// open
+#include <unistd.h>		// write, fsync, close
+#include <sys/mman.h>	// mmap
+#include <sys/stat.h>	// fstat
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+// Number the symmetry classes in order of their first (lowest-index) board
+CanonTable::CanonTable()
+	{
+	int count = 0;
+	for (int index = 0; index < NumStates; ++index)
+		{
+		int x[9], digits = index;
+		for (int i = 0; i < 9; ++i, digits /= 3)
+			x[i] = digits % 3 - 1;
+
+		State c = canonical(State::fromArray(x));
+		if (stateIndex(c) == index)
+			{
+			board[count] = c;
+			id[index] = count++;
+			}
+		else
+			id[index] = id[stateIndex(c)];	// the canonical board has a lower index
+		}
+	assert(count == NumCanon);
+	}
+
+CanonTable canonTable;
+
+void saveVToFile(string filename, std::list<State> &states, VTable &V)
+	{
+	ofstream file2(filename);
+
+	// file2 << "Size is " << to_string(states.size());
+	// file2 << "Size is " << to_string(V.size());
+	// file2 << "\nDon't know why... \n";
+
+	for (std::list<State>::iterator it = states.begin(); it != states.end(); ++it)
+		{
+		char state_string[9 * 2 + 1];
+		for (int i = 0; i < 9; ++i)
+			{
+			state_string[i * 2] = (*it).at(i) + '0';
+			state_string[i * 2 + 1] = ':';
+			}
+		state_string[17] = ' ';
+		state_string[18] = '\0';
+
+		std::ostringstream strs;
+		strs << V[*it];
+		string value_string = strs.str();
+
+		file2 << state_string << value_string << endl;
+		// file2 << value_string << "\n";
+		// file2 << state_string << "\n";
+		// file2 << "testing" << endl;
+		}
+	file2.close();
+	}
+
+// Only the canonical boards are added to states, with the average value of all the
+// symmetric boards in the file.  Returns the number of canonical boards read.
+int loadVFromFile(string filename, std::list<State> &states, VTable &V)
+	{
+	ifstream file1(filename);
+
+	string line;
+	State state;
+	int total = 0;
+	static double sums[NumCanon];
+	static int counts[NumCanon];
+	for (int c = 0; c < NumCanon; ++c)
+		counts[c] = 0;
+	while (getline(file1, line))
+		{
+		// cout << line;
+		int x[9];
+		for (int i = 0; i < 9; ++i)
+			x[i] = line[i * 2] - '0';
+		state = canonical(State::fromArray(x));
+		// printState(state);
+
+		double value = std::stod(line.substr(18));
+		// cout << "\t" << value << "\n";
+		int c = canonTable.id[stateIndex(state)];
+		if (counts[c]++ == 0)
+			{
+			states.push_front(state);
+			sums[c] = 0.0;
+			++total;
+			}
+		sums[c] += value;
+		V[state] = sums[c] / counts[c];
+		}
+	file1.close();
+	return total;
+	}
+
+struct VTableHeader
+	{
+	char magic[4];
+	int version;
+	int entries;
+	int entrySize;
+	};
+
+static const VTableHeader vtbHeader = {{'T', 'T', 'T', 'V'}, 1, NumCanon, sizeof (double)};
+
+// Write the values of states, atomically.  Returns false on error.
+bool saveVTable(string filename, std::list<State> &states, VTable &V)
+	{
+	static struct
+		{
+		VTableHeader header;
+		double v[NumCanon];
+		} file;
+
+	file.header = vtbHeader;
+	for (int c = 0; c < NumCanon; ++c)
+		file.v[c] = NAN;
+	for (std::list<State>::iterator it = states.begin(); it != states.end(); ++it)
+		file.v[canonTable.id[stateIndex(*it)]] = V[*it];
+
+	string tmpname = filename + ".tmp";
+	int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		{
+		perror(tmpname.c_str());
+		return false;
+		}
+
+	const char *p = (const char *) &file;
+	size_t left = sizeof file;
+	while (left > 0)
+		{
+		ssize_t written = write(fd, p, left);
+		if (written < 0)
+			{
+			perror(tmpname.c_str());
+			close(fd);
+			unlink(tmpname.c_str());
+			return false;
+			}
+		p += written;
+		left -= written;
+		}
+
+	if (fsync(fd) != 0 || close(fd) != 0 || rename(tmpname.c_str(), filename.c_str()) != 0)
+		{
+		perror(filename.c_str());
+		unlink(tmpname.c_str());
+		return false;
+		}
+	return true;
+	}
+
+// Returns the number of boards with values, or -1 if the file is missing or not a V-table.
+// The boards are added to states, as in loadVFromFile().
+int loadVTable(string filename, std::list<State> &states, VTable &V)
+	{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	const size_t size = sizeof (VTableHeader) + NumCanon * sizeof (double);
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size != size)
+		{
+		close(fd);
+		return -1;
+		}
+
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	const VTableHeader *header = (const VTableHeader *) map;
+	if (memcmp(header, &vtbHeader, sizeof (VTableHeader)) != 0)
+		{
+		munmap(map, size);
+		return -1;
+		}
+
+	const double *v = (const double *) (header + 1);
+	int total = 0;
+	for (int c = 0; c < NumCanon; ++c)
+		if (isnan(v[c]))
+			V.v[c] = 0.0;
+		else
+			{
+			V.v[c] = v[c];
+			states.push_front(canonTable.board[c]);
+			++total;
+			}
+
+	munmap(map, size);
+	return total;
+	}
+
+// Load the values of "name":  from the binary name.vtb if there is one, otherwise from
+// the text file name.dat, which is then converted to name.vtb for next time.
+int loadValues(string name, std::list<State> &states, VTable &V)
+	{
+	int total = loadVTable(name + ".vtb", states, V);
+	if (total >= 0)
+		return total;
+
+	total = loadVFromFile(name + ".dat", states, V);
+	if (total > 0)
+		saveVTable(name + ".vtb", states, V);
+	return total;
+	}
@@ -5,6 +5,7 @@
 #include <stdbool.h>		// constants "true" and "false"
 #include <math.h>
 #include <assert.h>
+#include <string.h>			// memcpy
 #include <time.h>			// time as random seed in create_NN()
 #include "feedforward-NN.h"
 
@@ -78,15 +79,22 @@ NNET *create_NN(int numLayers, int *neuronsPerLayer)
 	net->layers[0].numNeurons = neuronsPerLayer[0];
 	net->layers[0].neurons = (NEURON *) malloc(neuronsPerLayer[0] * sizeof (NEURON));
 
+	// All weights are allocated as 1 block, so that a whole net can be copied at once
+	net->numWeights = 0;
+	for (int l = 1; l < numLayers; ++l)
+		net->numWeights += neuronsPerLayer[l] * (neuronsPerLayer[l - 1] + 1);
+	net->weights = (double *) malloc(net->numWeights * sizeof (double));
+
 	//construct hidden layers
+	double *weights = net->weights;
 	for (int l = 1; l < numLayers; ++l) //construct layers
 		{
 		net->layers[l].neurons = (NEURON *) malloc(neuronsPerLayer[l] * sizeof (NEURON));
 		net->layers[l].numNeurons = neuronsPerLayer[l];
 		for (int n = 0; n < neuronsPerLayer[l]; ++n) // construct each neuron in the layer
 			{
-			net->layers[l].neurons[n].weights =
-					(double *) malloc((neuronsPerLayer[l - 1] + 1) * sizeof (double));
+			net->layers[l].neurons[n].weights = weights;
+			weights += neuronsPerLayer[l - 1] + 1;
 			for (int i = 1; i <= neuronsPerLayer[l - 1]; ++i)
 				//when i = 0, it's bias weight (this can be ignored)
 				net->layers[l].neurons[n].weights[i] = randomWeight();
@@ -105,21 +113,22 @@ void re_randomize(NNET *net, int numLayers, int *neuronsPerLayer)
 				net->layers[l].neurons[n].weights[i] = randomWeight();
 	}
 
+// neuronsPerLayer is no longer needed, since the weights are freed as 1 block;  it is kept
+// so that the callers (and Jacobian-NN.c's free_NN) keep the same signature
 void free_NN(NNET *net, int *neuronsPerLayer)
 	{
+	(void) neuronsPerLayer;
+
 	// for input layer
 	free(net->layers[0].neurons);
 
 	// for each hidden layer
 	int numLayers = net->numLayers;
 	for (int l = 1; l < numLayers; l++) // for each layer
-		{
-		for (int n = 0; n < neuronsPerLayer[l]; n++) // for each neuron in the layer
-			{
-			free(net->layers[l].neurons[n].weights);
-			}
 		free(net->layers[l].neurons);
-		}
+
+	// all weights are in 1 block
+	free(net->weights);
 
 	// free all layers
 	free(net->layers);
@@ -128,6 +137,68 @@ void free_NN(NNET *net, int *neuronsPerLayer)
 	free(net);
 	}
 
+// Allocate scratch space for propagating up to "size" inputs through net at once
+BATCH *create_batch(NNET *net, int size)
+	{
+	BATCH *batch = (BATCH *) malloc(sizeof (BATCH));
+	batch->size = size;
+	batch->numLayers = net->numLayers;
+	batch->outputs = (double **) malloc(net->numLayers * sizeof (double *));
+	batch->grads = (double **) malloc(net->numLayers * sizeof (double *));
+
+	for (int l = 0; l < net->numLayers; ++l)
+		{
+		int numNeurons = net->layers[l].numNeurons;
+		batch->outputs[l] = (double *) malloc(size * numNeurons * sizeof (double));
+		batch->grads[l] = (double *) malloc(size * numNeurons * sizeof (double));
+		}
+	return batch;
+	}
+
+void free_batch(BATCH *batch)
+	{
+	for (int l = 0; l < batch->numLayers; ++l)
+		{
+		free(batch->outputs[l]);
+		free(batch->grads[l]);
+		}
+	free(batch->outputs);
+	free(batch->grads);
+	free(batch);
+	}
+
+// Copy all weights of src to dst, which must have the same topology:  a single memcpy
+void sync_NN(NNET *dst, NNET *src)
+	{
+	assert(dst->numWeights == src->numWeights);
+	memcpy(dst->weights, src->weights, src->numWeights * sizeof (double));
+	}
+
+// Create a new net with the same topology and weights as net
+// (Unlike create_NN, this does not touch the random seed.)
+NNET *clone_NN(NNET *net)
+	{
+	NNET *copy = (NNET *) malloc(sizeof (NNET));
+	copy->numLayers = net->numLayers;
+	copy->layers = (LAYER *) malloc(net->numLayers * sizeof (LAYER));
+	copy->numWeights = net->numWeights;
+	copy->weights = (double *) malloc(net->numWeights * sizeof (double));
+
+	for (int l = 0; l < net->numLayers; ++l)
+		{
+		int numNeurons = net->layers[l].numNeurons;
+		copy->layers[l].numNeurons = numNeurons;
+		copy->layers[l].neurons = (NEURON *) malloc(numNeurons * sizeof (NEURON));
+		if (l > 0)		// same offsets into the weight block as the original
+			for (int n = 0; n < numNeurons; ++n)
+				copy->layers[l].neurons[n].weights = copy->weights +
+						(net->layers[l].neurons[n].weights - net->weights);
+		}
+
+	sync_NN(copy, net);
+	return copy;
+	}
+
 //**************************** forward-propagation ***************************//
 
 void forward_prop_sigmoid(NNET *net, int dim_V, double V[])
@@ -176,6 +247,120 @@ void forward_prop_sigmoid(NNET *net, int dim_V, double V[])
 		}
 	}
 
+// **** Incremental forward-prop
+// Same as forward_prop_sigmoid, but the induced local fields of the 1st hidden layer are
+// cached.  When the new input differs from the previous one in only a few components,
+// each changed input V_k updates the fields in O(width):
+//		field_n += W_nk (V_k - oldV_k)
+// instead of redoing the whole input × hidden product.  If more than half of the inputs
+// have changed, the fields are computed from scratch.  Each update adds at most 1 rounding
+// error (≈ 1e-16 × |field|) and the fields are recomputed after every IncrRefresh updates,
+// so the result differs from forward_prop_sigmoid by at most ≈ IncrRefresh × 1e-16 × |field|,
+// and which boards were evaluated before can flip exact ties.  A caller that needs
+// bit-exact values (eg. to break ties the same way every time) should call
+// forward_prop_sigmoid instead.
+// NOTE: The cache does not know when the weights change;  call invalidate_incr() after
+// back-prop or any other weight update.
+
+INCR *create_incr(NNET *net)
+	{
+	INCR *cache = (INCR *) malloc(sizeof (INCR));
+	cache->net = net;
+	cache->input = (double *) malloc(net->layers[0].numNeurons * sizeof (double));
+	cache->field = (double *) malloc(net->layers[1].numNeurons * sizeof (double));
+	cache->updates = 0;
+	cache->valid = 0;
+	return cache;
+	}
+
+void free_incr(INCR *cache)
+	{
+	free(cache->input);
+	free(cache->field);
+	free(cache);
+	}
+
+void invalidate_incr(INCR *cache)
+	{
+	cache->valid = 0;
+	}
+
+void forward_prop_sigmoid_incr(NNET *net, INCR *cache, int dim_V, double V[])
+	{
+	#define IncrRefresh	1000
+	LAYER firstLayer = net->layers[1];
+
+	int changed = 0;
+	if (cache->valid && cache->updates < IncrRefresh)
+		for (int k = 0; k < dim_V; ++k)
+			if (V[k] != cache->input[k])
+				++changed;
+
+	if (!cache->valid || cache->updates >= IncrRefresh || changed > dim_V / 2)
+		{
+		// full computation of the fields
+		for (int n = 0; n < firstLayer.numNeurons; n++)
+			{
+			double *weights = firstLayer.neurons[n].weights;
+			double v = weights[0] * BIASINPUT;
+			for (int k = 0; k < dim_V; k++)
+				v += weights[k + 1] * V[k];
+			cache->field[n] = v;
+			}
+		cache->updates = 0;
+		cache->valid = 1;
+		}
+	else
+		{
+		// update the fields for the changed inputs only
+		for (int k = 0; k < dim_V; ++k)
+			if (V[k] != cache->input[k])
+				{
+				double d = V[k] - cache->input[k];
+				for (int n = 0; n < firstLayer.numNeurons; n++)
+					cache->field[n] += firstLayer.neurons[n].weights[k + 1] * d;
+				}
+		cache->updates += changed;
+		}
+
+	// set the output of input layer
+	for (int i = 0; i < dim_V; ++i)
+		{
+		cache->input[i] = V[i];
+		net->layers[0].neurons[i].output = V[i];
+		}
+
+	// calculate output from hidden layers to output layer
+	for (int l = 1; l < net->numLayers; l++)
+		{
+		for (int n = 0; n < net->layers[l].numNeurons; n++)
+			{
+			double v; //induced local field for neurons
+			if (l == 1)
+				v = cache->field[n];
+			else
+				{
+				v = net->layers[l].neurons[n].weights[0] * BIASINPUT;
+				for (int k = 1; k <= net->layers[l - 1].numNeurons; k++)
+					v += net->layers[l].neurons[n].weights[k] *
+						net->layers[l - 1].neurons[k - 1].output;
+				}
+
+			if (!LastAct && l == net->numLayers - 1)
+				{
+				net->layers[l].neurons[n].output = v;
+				net->layers[l].neurons[n].grad = 1.0;
+				}
+			else
+				{
+				double output = sigmoid(v);
+				net->layers[l].neurons[n].output = output;
+				net->layers[l].neurons[n].grad = Steepness * output * (1.0 - output);
+				}
+			}
+		}
+	}
+
 // Same as above, except with soft_plus activation function
 void forward_prop_softplus(NNET *net, int dim_V, double V[])
 	{
@@ -273,6 +458,50 @@ void forward_prop_x2(NNET *net, int dim_V, double V[])
 		}
 	}
 
+// Same as forward_prop_sigmoid, but for a batch of inputs.
+// V holds "rows" input vectors of dimension dim_V, one after another (rows ≤ batch->size).
+// The network's own neurons are not touched, results go into batch->outputs and the
+// σ' values into batch->grads.  So the same net can be shared by several batches (threads).
+void forward_prop_sigmoid_batch(NNET *net, BATCH *batch, int rows, int dim_V, double V[])
+	{
+	// set the output of input layer
+	for (int i = 0; i < rows * dim_V; ++i)
+		batch->outputs[0][i] = V[i];
+
+	// calculate output from hidden layers to output layer
+	for (int l = 1; l < net->numLayers; l++)
+		{
+		int numInputs = net->layers[l - 1].numNeurons;
+		int numNeurons = net->layers[l].numNeurons;
+
+		for (int b = 0; b < rows; ++b)				// for each input vector in the batch
+			{
+			double *input = batch->outputs[l - 1] + b * numInputs;
+			double *output = batch->outputs[l] + b * numNeurons;
+			double *grad = batch->grads[l] + b * numNeurons;
+
+			for (int n = 0; n < numNeurons; n++)
+				{
+				double *weights = net->layers[l].neurons[n].weights;
+				double v = weights[0] * BIASINPUT;	// induced local field for neurons
+				for (int k = 0; k < numInputs; k++)
+					v += weights[k + 1] * input[k];
+
+				if (!LastAct && l == net->numLayers - 1)
+					{
+					output[n] = v;
+					grad[n] = 1.0;
+					}
+				else
+					{
+					output[n] = sigmoid(v);
+					grad[n] = Steepness * output[n] * (1.0 - output[n]);
+					}
+				}
+			}
+		}
+	}
+
 //****************************** back-propagation ***************************//
 // The error is propagated backwards starting from the output layer, hence the
 // name for this algorithm.
@@ -297,7 +526,12 @@ void forward_prop_x2(NNET *net, int dim_V, double V[])
 // Bryson, Denham, and Dreyfus in 1963 and by Bryson and Yu-Chi Ho in 1969 as a solution to
 // optimization problems.  The book "Talking Nets" interviewed some of these people.
 
-void back_prop(NNET *net, double *errors)
+// The back-prop is split in 2 halves:  back_prop_grads() computes the local gradients
+// ∇ for all layers, and update_weights() applies "η ∙ input ∙ ∇" to the weights.  This
+// allows the local gradients to be used for other purposes (eg. the input gradient below)
+// without changing the weights.
+
+void back_prop_grads(NNET *net, double *errors)
 	{
 	int numLayers = net->numLayers;
 	LAYER lastLayer = net->layers[numLayers - 1];
@@ -328,6 +562,11 @@ void back_prop(NNET *net, double *errors)
 			net->layers[l].neurons[n].grad *= sum;
 			}
 		}
+	}
+
+void update_weights(NNET *net)
+	{
+	int numLayers = net->numLayers;
 
 	// update all weights
 	for (int l = 1; l < numLayers; ++l)		// except for 0th layer which has no weights
@@ -346,6 +585,123 @@ void back_prop(NNET *net, double *errors)
 		}
 	}
 
+void back_prop(NNET *net, double *errors)
+	{
+	back_prop_grads(net, errors);
+	update_weights(net);
+	}
+
+// **** Gradient with respect to the input layer
+// Same as back-prop, except that the weights are NOT updated, and the local gradients are
+// propagated one step further to the input layer.  The input layer has no σ', so:
+//		∂y/∂V_i = Σ_n W_ni ∇_n			(summed over neurons n of the 1st hidden layer)
+// With errors = [1.0] and a single output neuron, gradV = ∇_V y, ie, the gradient of the
+// network's output w.r.t. its input, in one forward + backward sweep.
+// The network must have been forward-propagated with the input V beforehand.
+
+void back_prop_input(NNET *net, double *errors, double *gradV)
+	{
+	back_prop_grads(net, errors);
+
+	LAYER firstLayer = net->layers[1];
+	for (int i = 0; i < net->layers[0].numNeurons; ++i)		// for each input
+		{
+		double sum = 0.0;
+		for (int n = 0; n < firstLayer.numNeurons; ++n)
+			sum += firstLayer.neurons[n].weights[i + 1]		// ignore weights[0] = bias
+					* firstLayer.neurons[n].grad;
+		gradV[i] = sum;
+		}
+	}
+
+// Same as back_prop_grads, but for a batch that has been forward-propagated with
+// forward_prop_sigmoid_batch.  "errors" holds one error vector per row.
+void back_prop_grads_batch(NNET *net, BATCH *batch, int rows, double *errors)
+	{
+	int numLayers = net->numLayers;
+	int numOutputs = net->layers[numLayers - 1].numNeurons;
+
+	// calculate gradient for output layer
+	for (int i = 0; i < rows * numOutputs; ++i)
+		batch->grads[numLayers - 1][i] *= errors[i];
+
+	// calculate gradient for hidden layers
+	for (int l = numLayers - 2; l > 0; --l)		// for each hidden layer
+		{
+		int numNeurons = net->layers[l].numNeurons;
+		LAYER prevLayer = net->layers[l + 1];
+
+		for (int b = 0; b < rows; ++b)
+			{
+			double *grad = batch->grads[l] + b * numNeurons;
+			double *prevGrad = batch->grads[l + 1] + b * prevLayer.numNeurons;
+
+			for (int n = 0; n < numNeurons; n++)		// for each neuron in layer
+				{
+				double sum = 0.0;
+				for (int i = 0; i < prevLayer.numNeurons; i++)		// for each weight
+					sum += prevLayer.neurons[i].weights[n + 1]		// ignore weights[0] = bias
+							* prevGrad[i];
+				grad[n] *= sum;
+				}
+			}
+		}
+	}
+
+// Same as back_prop_input, but for a batch.  gradV receives one input gradient per row.
+void back_prop_input_batch(NNET *net, BATCH *batch, int rows, double *errors, double *gradV)
+	{
+	back_prop_grads_batch(net, batch, rows, errors);
+
+	int numInputs = net->layers[0].numNeurons;
+	LAYER firstLayer = net->layers[1];
+	for (int b = 0; b < rows; ++b)
+		{
+		double *grad = batch->grads[1] + b * firstLayer.numNeurons;
+		for (int i = 0; i < numInputs; ++i)		// for each input
+			{
+			double sum = 0.0;
+			for (int n = 0; n < firstLayer.numNeurons; ++n)
+				sum += firstLayer.neurons[n].weights[i + 1]		// ignore weights[0] = bias
+						* grad[n];
+			gradV[b * numInputs + i] = sum;
+			}
+		}
+	}
+
+// Same as update_weights, but the weight changes of all rows of the batch are added up,
+// and applied once:  ΔW_ni = η Σ_b ∇_n[b] input_i[b]
+void update_weights_batch(NNET *net, BATCH *batch, int rows)
+	{
+	for (int l = 1; l < net->numLayers; ++l)		// except for 0th layer which has no weights
+		{
+		int numInputs = net->layers[l - 1].numNeurons;
+		int numNeurons = net->layers[l].numNeurons;
+
+		for (int n = 0; n < numNeurons; n++)		// for each neuron
+			{
+			double *weights = net->layers[l].neurons[n].weights;
+			for (int b = 0; b < rows; ++b)
+				{
+				double grad = Eta * batch->grads[l][b * numNeurons + n];
+				double *input = batch->outputs[l - 1] + b * numInputs;
+
+				weights[0] += grad * 1.0;				// 1.0f = bias input
+				for (int i = 0; i < numInputs; i++)		// for each weight
+					weights[i + 1] += grad * input[i];
+				}
+			}
+		}
+	}
+
+// Back-prop for a whole batch, with a single weight update.
+// To get the mean instead of the sum of the changes, divide the errors by the batch size.
+void back_prop_batch(NNET *net, BATCH *batch, int rows, double *errors)
+	{
+	back_prop_grads_batch(net, batch, rows, errors);
+	update_weights_batch(net, batch, rows);
+	}
+
 // Calculate error between output of forward-prop and a given answer Y
 double calc_error(NNET *net, double Y[], double *errors)
 	{
@@ -0,0 +1,2 @@
+gcc -O2 -c quadratic-NN.c -o quadratic-NN.o
+g++ -O2 symmetric-test.cpp quadratic-NN.o -o quadratic-NN
@@ -0,0 +1 @@
+g++ -O2 -fopenmp-simd -pthread set-distance.cpp -o set-distance
@@ -0,0 +1 @@
+g++ ttt-convert.cpp V-table.cpp -o ttt-convert
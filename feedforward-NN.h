@@ -19,6 +19,31 @@ typedef struct NNET
 	{
     int numLayers;
     LAYER *layers;
+    double *weights;		// all the neurons' weights, in one contiguous block
+    int numWeights;
 	} NNET; //neural network
 
 #define dim_K	10
+
+//*********************struct for BATCH***********************************//
+// Scratch space for propagating many inputs through the same NNET at once.
+// outputs[l] and grads[l] are (size × numNeurons of layer l) matrices, stored row by row.
+typedef struct BATCH
+	{
+    int size;
+    int numLayers;
+    double **outputs;
+    double **grads;
+	} BATCH;
+
+//*********************struct for INCR************************************//
+// Cache for incremental forward-prop: the last input vector and the induced local fields
+// of the 1st hidden layer that it produced.
+typedef struct INCR
+	{
+    NNET *net;				// the net whose fields are cached
+    double *input;			// last input vector
+    double *field;			// Σ_k W_nk input_k of the 1st hidden layer, incl. bias
+    int updates;			// incremental updates since the last full computation
+    int valid;				// 0 = must be recomputed (eg. after the weights have changed)
+	} INCR;
@@ -0,0 +1,323 @@
+// Play many tic-tac-toe games at once as C++20 coroutines, batching the neural-net
+// evaluations of all the games.
+
+// Every game is a coroutine.  When the net player has to score its candidate moves, the
+// game co_awaits an Evaluate with the input rows, which suspends it and queues the rows
+// at the Scheduler.  The scheduler keeps resuming the other games until
+//	* the pending rows reach batchSize, or
+//	* the oldest pending request has waited maxLatency μs, or
+//	* no game can proceed,
+// then evaluates all the pending rows in 1 forward pass (get_V_batch or getQ_pairs) and
+// makes the games ready again.  With batchSize = 1, every request is evaluated as soon as
+// it is made, like the sequential players do.
+
+#include <iostream>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+#define dimK	9
+
+extern "C"
+	{
+	// functions from V-learning.c
+	void load_Vnet(void);
+	void get_V_batch(int n, int x[][9], double v[]);
+
+	// functions from Q-learning.c
+	void load_Qnet(char const *);
+	void getQ_pairs(int n, double K12s[], double Qs[]);
+
+	// functions from visualization.c
+	void beep();
+	}
+
+// ******** Functions from tic-tac-toe.cpp and V-table.cpp
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int argmaxMove(int n, int moves[9], double values[9]);
+extern int hasWinner(const State &s);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+
+// Evaluates rows of inputs, of the width given to the Scheduler
+typedef void (*Evaluator)(int rows, double *inputs, double *outputs);
+
+// **** A game, as a coroutine that returns the winner (1 or -1) or 0 for a draw
+struct Game
+	{
+	struct promise_type
+		{
+		int index = 0;			// of the game in Scheduler::run()
+		int winner = 0;
+
+		Game get_return_object()
+			{
+			return Game{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_value(int w) { winner = w; }
+		void unhandled_exception() { std::terminate(); }
+		};
+
+	std::coroutine_handle<promise_type> handle;
+	};
+
+typedef std::coroutine_handle<Game::promise_type> GameHandle;
+
+class Scheduler
+	{
+public:
+	Scheduler(int width, Evaluator eval, int batchSize, double maxLatency)
+		: width(width), eval(eval), batchSize(batchSize), maxLatency(maxLatency) {}
+
+	// Play numGames games, made by newGame(i), with at most concurrency of them at once.
+	// Returns the winners, indexed by game.
+	template <typename F>
+	vector<int> run(int numGames, int concurrency, F newGame);
+
+	// statistics of the last run
+	long batches = 0;
+	long rows = 0;
+
+private:
+	struct Request
+		{
+		GameHandle game;
+		int rows;
+		double *inputs;
+		double *outputs;
+		};
+
+	int width;
+	Evaluator eval;
+	int batchSize;
+	double maxLatency;			// in μs
+
+	std::deque<GameHandle> ready;
+	vector<Request> pending;
+	int pendingRows = 0;
+	chrono::steady_clock::time_point oldest;	// time of the oldest pending request
+	vector<double> inputs, outputs;
+
+	void submit(GameHandle game, int n, double *in, double *out);
+	void flush();
+
+	friend struct Evaluate;
+	};
+
+// co_await Evaluate{scheduler, n, inputs, outputs} evaluates n rows of inputs
+struct Evaluate
+	{
+	Scheduler &scheduler;
+	int rows;
+	double *inputs;
+	double *outputs;
+
+	bool await_ready() { return rows == 0; }
+	void await_suspend(GameHandle game) { scheduler.submit(game, rows, inputs, outputs); }
+	void await_resume() {}
+	};
+
+void Scheduler::submit(GameHandle game, int n, double *in, double *out)
+	{
+	if (pending.empty())
+		oldest = chrono::steady_clock::now();
+	pending.push_back({game, n, in, out});
+	pendingRows += n;
+	}
+
+// Evaluate all the pending rows at once
+void Scheduler::flush()
+	{
+	inputs.resize((size_t) pendingRows * width);
+	outputs.resize(pendingRows);
+
+	int r = 0;
+	for (Request &req : pending)
+		{
+		copy(req.inputs, req.inputs + req.rows * width, inputs.begin() + (size_t) r * width);
+		r += req.rows;
+		}
+
+	eval(pendingRows, inputs.data(), outputs.data());
+	++batches;
+	rows += pendingRows;
+
+	r = 0;
+	for (Request &req : pending)
+		{
+		copy(outputs.begin() + r, outputs.begin() + r + req.rows, req.outputs);
+		r += req.rows;
+		ready.push_back(req.game);
+		}
+	pending.clear();
+	pendingRows = 0;
+	}
+
+template <typename F>
+vector<int> Scheduler::run(int numGames, int concurrency, F newGame)
+	{
+	vector<int> winners(numGames);
+	batches = rows = 0;
+
+	int started = 0, finished = 0;
+	auto start = [&]()
+		{
+		GameHandle game = newGame(started).handle;
+		game.promise().index = started++;
+		ready.push_back(game);
+		};
+	while (started < numGames && started < concurrency)
+		start();
+
+	while (finished < numGames)
+		{
+		bool due = !pending.empty() && (ready.empty() || pendingRows >= batchSize ||
+			chrono::duration<double, micro>(chrono::steady_clock::now() - oldest).count() >= maxLatency);
+		if (due)
+			{
+			flush();
+			continue;
+			}
+
+		GameHandle game = ready.front();
+		ready.pop_front();
+		game.resume();
+		if (!game.done())
+			continue;				// it is waiting for an evaluation
+
+		// The game is over, start a new one in its place
+		winners[game.promise().index] = game.promise().winner;
+		game.destroy();
+		++finished;
+		if (started < numGames)
+			start();
+		}
+	return winners;
+	}
+
+// **** Evaluators
+static void evaluateV(int n, double *inputs, double *outputs)
+	{
+	vector<int> x((size_t) n * 9);
+	for (size_t i = 0; i < x.size(); ++i)
+		x[i] = (int) inputs[i];
+	get_V_batch(n, (int (*)[9]) x.data(), outputs);
+	}
+
+static void evaluateQ(int n, double *inputs, double *outputs)
+	{
+	getQ_pairs(n, inputs, outputs);
+	}
+
+#define exploreRate		0.1
+
+// Player 1 is the net (V-net or Q-net), player -1 plays greedily on V2.
+// With useQ, the moves are scored by Q(board, next board) as in Q_greedyMoveSayaka1,
+// otherwise by V(canonical next board) as in computerMove.
+Game netGame(Scheduler &scheduler, const VTable &V2, bool useQ, unsigned seed)
+	{
+	std::minstd_rand rng(seed);
+	std::uniform_real_distribution<double> uniform;
+
+	State board;
+	int player = (uniform(rng) > 0.5) ? 1 : -1;
+	double inputs[9 * 2 * dimK], values[9];
+
+	while (true)
+		{
+		int moves[9];
+		State next[9];
+		int n = legalMoves(board, player, moves, next);
+
+		int move;
+		if (uniform(rng) <= exploreRate)
+			move = moves[(int) (uniform(rng) * n) % n];
+		else if (player == -1)
+			{
+			for (int m = 0; m < n; ++m)
+				values[m] = V2.v[canonTable.id[stateIndex(next[m])]];
+			move = argmaxMove(n, moves, values);
+			}
+		else
+			{
+			int width = useQ ? 2 * dimK : dimK;
+			for (int m = 0; m < n; ++m)
+				{
+				Board b = useQ ? next[m].array() : canonical(next[m]).array();
+				for (int k = 0; k < dimK; ++k)
+					{
+					if (useQ)
+						inputs[m * width + k] = board.at(k);
+					inputs[m * width + width - dimK + k] = b.x[k];
+					}
+				}
+			co_await Evaluate{scheduler, n, inputs, values};
+			move = argmaxMove(n, moves, values);
+			}
+
+		board.set(move, player);
+		int won = hasWinner(board);
+		if (won != 0)
+			co_return (won == -2) ? 0 : won;
+		player = -player;
+		}
+	}
+
+// **** Benchmark:  the same games with different batch sizes.
+// The games and their results do not depend on the batching, only the speed does.
+extern "C" void game_scheduler_benchmark()
+	{
+	std::list<State> states2;
+	static VTable V2;
+	cout << "Loading player -1...\n";
+	int totalStates2 = loadValues("ttt2", states2, V2);
+	cout << "Total read: " << to_string(totalStates2) << "\n";
+
+	cout << "[v] = V-net player (v.net)\n";
+	cout << "[q] = Q-net player (Q.net)\n";
+	char key;
+	do
+		key = getchar();
+	while (key == '\n');
+	bool useQ = (key == 'q');
+	if (useQ)
+		load_Qnet("Q.net");
+	else
+		load_Vnet();
+
+	#define BenchGames		20000
+	#define Concurrency		1024		// games in progress at once
+	#define MaxLatency		1000.0		// μs
+	const int batchSizes[] = {1, 16, 64, 256, 1024};
+
+	printf("\n batch   games/sec   forward passes   rows/pass   wins(1)\n");
+	for (int batchSize : batchSizes)
+		{
+		Scheduler scheduler(useQ ? 2 * dimK : dimK, useQ ? evaluateQ : evaluateV, batchSize, MaxLatency);
+
+		auto start = chrono::steady_clock::now();
+		vector<int> winners = scheduler.run(BenchGames, Concurrency, [&](int g)
+			{
+			return netGame(scheduler, V2, useQ, 12345 + g);
+			});
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		int wins = 0;
+		for (int w : winners)
+			if (w == 1)
+				++wins;
+		printf("%6d %11.0f %16ld %11.1f %8.1f%%\n", batchSize, BenchGames / seconds,
+			scheduler.batches, scheduler.rows / (double) scheduler.batches, wins * 100.0 / BenchGames);
+		}
+	beep();
+	}
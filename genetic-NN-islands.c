@@ -0,0 +1,293 @@
+// Island model of the genetic NN:  K populations evolve in separate processes, and every
+// G generations each island sends copies of its best candidates to the next island in a
+// ring, where they replace the worst ones.
+
+// Each island is a forked copy of genifer, so it has its own globals of genetic-NN.c
+// (population, score, samples) and runs nextGeneration() exactly like evolve() does, only
+// without the keyboard.  Islands differ by their baseSeed, so they start from different
+// populations and train on different samples.
+//
+// The ring is made of sockets:  island k sends to link[k] and receives from link[k-1].
+// Here the links are local socketpairs;  islands on other boxes would use connected TCP
+// sockets instead, the migration code only sees 2 file descriptors.  Every island sends
+// before it receives, and a migration message is small (< 1 KB), so the sends never block.
+// An island that loses its neighbour (EOF on the socket) keeps evolving on its own.
+//
+// Every migration is followed by a checkpoint, island-<k>.ckpt.  A new run with the same
+// population size resumes each island from its checkpoint.  The islands are deterministic,
+// so a resumed run ends with the same populations as an uninterrupted one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>			// memcpy, memcmp
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>			// clock_gettime
+#include <unistd.h>			// fork, sysconf
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+#include "genetic-NN.h"
+
+#define Migrants		2		// candidates per layer sent to the next island, ≤ M - N
+#define MaxIslands		256
+
+// Progress of each island, in memory shared with the parent process
+typedef struct ISLAND
+	{
+	int firstGen;					// 1, or the generation after the checkpoint
+	int generation;					// last generation done
+	double error;					// of the top network, at the last migration
+	double seconds;
+	bool alone;						// lost its neighbour
+	} ISLAND;
+
+static double now()
+	{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+	}
+
+// **** Transport
+static bool sendAll(int fd, const void *buffer, size_t size)
+	{
+	const char *p = buffer;
+	while (size > 0)
+		{
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);		// no SIGPIPE if the peer is gone
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+		}
+	return true;
+	}
+
+static bool recvAll(int fd, void *buffer, size_t size)
+	{
+	char *p = buffer;
+	while (size > 0)
+		{
+		ssize_t n = recv(fd, p, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+		}
+	return true;
+	}
+
+// Send the best Migrants of each layer to the next island, and replace the worst ones with
+// those of the previous island.  The population is sorted by score, best first.
+// Returns false if the previous island is gone.
+static bool migrate(int sendFd, int recvFd)
+	{
+	static double out[L - 1][Migrants][W], in[L - 1][Migrants][W];
+	for (int l = 1; l < L; ++l)
+		memcpy(out[l - 1], population[l], sizeof out[0]);
+	sendAll(sendFd, out, sizeof out);
+	if (!recvAll(recvFd, in, sizeof in))
+		return false;
+
+	for (int l = 1; l < L; ++l)
+		memcpy(population[l][M - Migrants], in[l - 1], sizeof in[0]);
+	// The immigrants were scored on the other island's samples
+	evaluatePopulation(population);
+	return true;
+	}
+
+// **** Checkpoints
+static const char ckptMagic[8] = {'G', 'N', 'N', 'I', 'S', 'L', 'E', '1'};
+
+static void checkpointName(char name[], int island)
+	{
+	sprintf(name, "island-%02d.ckpt", island);
+	}
+
+static void saveCheckpoint(int island, int generation)
+	{
+	char name[32], tmpName[40];
+	checkpointName(name, island);
+	sprintf(tmpName, "%s.tmp", name);
+	FILE *fp = fopen(tmpName, "wb");
+	if (fp == NULL)
+		return;
+
+	bool ok = fwrite(ckptMagic, sizeof ckptMagic, 1, fp) == 1
+		&& fwrite(&generation, sizeof generation, 1, fp) == 1
+		&& fwrite(&M, sizeof M, 1, fp) == 1
+		&& fwrite(&baseSeed, sizeof baseSeed, 1, fp) == 1;
+	for (int l = 1; l < L && ok; ++l)
+		ok = fwrite(population[l], sizeof population[l][0], M, fp) == (size_t) M;
+	if (fclose(fp) != 0 || !ok || rename(tmpName, name) != 0)
+		remove(tmpName);
+	}
+
+// Returns the generation of the checkpoint, or 0 if there is none for this island
+static int loadCheckpoint(int island)
+	{
+	char name[32];
+	checkpointName(name, island);
+	FILE *fp = fopen(name, "rb");
+	if (fp == NULL)
+		return 0;
+
+	char magic[8];
+	int generation, popSize;
+	unsigned seed;
+	bool ok = fread(magic, sizeof magic, 1, fp) == 1 && memcmp(magic, ckptMagic, sizeof magic) == 0
+		&& fread(&generation, sizeof generation, 1, fp) == 1
+		&& fread(&popSize, sizeof popSize, 1, fp) == 1 && popSize == M
+		&& fread(&seed, sizeof seed, 1, fp) == 1 && seed == baseSeed;
+	for (int l = 1; l < L && ok; ++l)
+		ok = fread(population[l], sizeof population[l][0], M, fp) == (size_t) M;
+	fclose(fp);
+	return ok ? generation : 0;
+	}
+
+// **** 1 island, in its own process
+static void runIsland(int island, int interval, int maxGens, int sendFd, int recvFd, ISLAND *status)
+	{
+	baseSeed += island;
+	int generation = loadCheckpoint(island);
+	if (generation == 0)
+		initPopulation();
+	else
+		{
+		drawSamples(generation);
+		evaluatePopulation(population);
+		}
+	status->firstGen = generation + 1;
+	status->generation = generation;
+	status->error = networkError(population);
+
+	double start = now();
+	while (generation < maxGens)
+		{
+		nextGeneration(++generation);
+		if (generation % interval != 0 && generation != maxGens)
+			continue;
+
+		if (!status->alone && !migrate(sendFd, recvFd))
+			status->alone = true;
+		saveCheckpoint(island, generation);
+
+		status->generation = generation;
+		status->error = networkError(population);
+		status->seconds = now() - start;
+		printf("island %2d  gen %5d:  error = %.5f%s\n", island, generation, status->error,
+			status->alone ? "  (alone)" : "");
+		fflush(stdout);
+		}
+	status->seconds = now() - start;
+	}
+
+// **** Evolve numIslands populations (0 = 1 per core) for maxGens generations, migrating
+// every interval generations.  Returns the best error of all the islands.
+double evolve_islands(int numIslands, int interval, int maxGens)
+	{
+	if (numIslands <= 0)
+		numIslands = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numIslands < 1)
+		numIslands = 1;
+	if (numIslands > MaxIslands)
+		numIslands = MaxIslands;
+	if (interval < 1)
+		interval = 1;
+	if (M < N + Migrants)
+		{
+		printf("Population of %d is too small for %d migrants\n", M, Migrants);
+		return -1.0;
+		}
+
+	ISLAND *status = mmap(NULL, numIslands * sizeof (ISLAND), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (status == MAP_FAILED)
+		{
+		perror("mmap");
+		return -1.0;
+		}
+	memset(status, 0, numIslands * sizeof (ISLAND));
+
+	// link[k][0] is island k's sending end, link[k][1] is island k+1's receiving end
+	static int link[MaxIslands][2];
+	for (int k = 0; k < numIslands; ++k)
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, link[k]) != 0)
+			{
+			perror("socketpair");
+			for (int j = 0; j < k; ++j)
+				close(link[j][0]), close(link[j][1]);
+			munmap(status, numIslands * sizeof (ISLAND));
+			return -1.0;
+			}
+
+	printf("%d islands of %d candidates per layer, %d migrants every %d generations\n",
+		numIslands, M, Migrants, interval);
+	// The children must not inherit worker threads, nor unflushed output
+	setThreads(1);
+	fflush(stdout);
+
+	double start = now();
+	static pid_t pids[MaxIslands];
+	for (int k = 0; k < numIslands; ++k)
+		{
+		pids[k] = fork();
+		if (pids[k] == 0)
+			{
+			int sendFd = link[k][0];
+			int recvFd = link[(k + numIslands - 1) % numIslands][1];
+			// Close the other ends, so that a neighbour's exit is seen as EOF
+			for (int j = 0; j < numIslands; ++j)
+				{
+				if (link[j][0] != sendFd)
+					close(link[j][0]);
+				if (link[j][1] != recvFd)
+					close(link[j][1]);
+				}
+			runIsland(k, interval, maxGens, sendFd, recvFd, &status[k]);
+			fflush(stdout);
+			_exit(0);
+			}
+		if (pids[k] < 0)
+			perror("fork");
+		}
+	for (int k = 0; k < numIslands; ++k)
+		close(link[k][0]), close(link[k][1]);
+	for (int k = 0; k < numIslands; ++k)
+		if (pids[k] > 0)
+			waitpid(pids[k], NULL, 0);
+	double seconds = now() - start;
+
+	printf("\n island   generations   error      generations/sec\n");
+	double best = -1.0;
+	long gens = 0;
+	for (int k = 0; k < numIslands; ++k)
+		{
+		ISLAND *s = &status[k];
+		int done = s->generation - s->firstGen + 1;
+		gens += done;
+		printf("%7d %6d - %-6d %.5f %12.1f%s\n", k, s->firstGen, s->generation, s->error,
+			(s->seconds > 0.0) ? done / s->seconds : 0.0, s->alone ? "  (alone)" : "");
+		if (s->generation > 0 && (best < 0.0 || s->error < best))
+			best = s->error;
+		}
+	printf("Best error = %.5f;  %.1f generations/sec over all islands\n", best, gens / seconds);
+
+	munmap(status, numIslands * sizeof (ISLAND));
+	return best;
+	}
+
+// Headless run with the defaults:  1 island per core
+void island_evolve()
+	{
+	#define IslandGens			1000
+	#define MigrationInterval	10
+	evolve_islands(0, MigrationInterval, IslandGens);
+	}
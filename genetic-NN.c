@@ -21,42 +21,205 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>			// memcpy
 #include <math.h>
 #include <assert.h>
-#include <time.h>			// time as random seed in create_NN()
+#include <time.h>			// clock_gettime
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>			// sysconf
+#include <gsl/gsl_cblas.h>	// cblas_dgemm
+#include "genetic-NN.h"
 // #include "feedforward-NN.h"
 
 #define Eta 0.01			// learning rate
 #define BIASOUTPUT 1.0		// output for bias. It's always 1.
+#define steepness 3.0		// of the sigmoid in back-prop.c, for σ'
 
-#define L				4		// L = number of layers
-#define N				5		// N = number of neurons per layer
-#define M				10		// M = number of "candidate" neurons per layer; M > N
 #define MaxGens			100
 #define CrossRate		0.98
 #define MutationRate	(1.0 / N)
+#define MutationSize	0.5		// a mutated weight moves by up to ± this much
+#define MaxThreads		64
+#define CandBlock		64		// candidates per task of the matrix evaluator
+
+int M = 20;						// M = number of "candidate" neurons per layer; M ≥ N
 
 // Sorry I have to use global variables to simplify code
 // =============================================================
 // A question is how to store the current network as well as the entire population.
 // Perhaps the data structure should store all the "population rows".
-double population[L][M][N];		// each element is a connection weight
-double output[L][M];			// output of each neuron
-double grad[L][M];				// local gradient for each neuron
-double score[L][M];				// fitness of each neuron
+// The network is made of the first N candidates of each layer (the best ones, after the
+// population is sorted by score).  Layer 0 is the input layer, it has no weights.
+double population[L][MaxM][W];	// each element is a connection weight
+double score[L][MaxM];			// fitness of each neuron, for the current generation
 
-double best[L][N][N];			// best candidate
-double selected[L][M][N];		// selected from binary tournament
-double children[L][M][N];		// 2nd generation
+double selected[L][MaxM][W];	// selected from binary tournament
+double children[L][MaxM][W];	// 2nd generation
+unsigned rngState[L][MaxM];		// each candidate's own random numbers, for 1 generation
 
 int neuronsPerLayer[L] = { N };		// initialize all layers to have N neurons
 int dimK = N;						// dimension of input-layer vector
 
-extern int rand(void);
-extern void qsort(void *, size_t, size_t, int (*comparator)(const void *, const void*));
-extern void forward_gNN(int, double []);		// forward-propagate the gNN
-extern void backprop_gNN(double []);
+// The samples that all the candidates are evaluated on, drawn once per generation
+#define NumTrials	100
+double samples[NumTrials][N];		// K
+double targets[NumTrials][N];		// K* = transition(K)
+
+extern double sigmoid(double);
+extern void transition(double [], double []);
+extern void forward_gNN(double *net[L][N], GSCRATCH *, int, double []);	// forward-propagate the gNN
+extern void gradient_gNN(double *net[L][N], GSCRATCH *, double []);
+extern void backprop_gNN(double *net[L][N], GSCRATCH *, double []);
+
+// **** Random numbers
+// Every random choice about a candidate is made with its own generator, seeded by
+// (generation, layer, index), so the results do not depend on the order in which the
+// candidates are processed, or on the number of threads.
+unsigned baseSeed = 12345;
+
+unsigned candidateSeed(int generation, int layer, int index)
+	{
+	// "splitmix" hash of the 3 numbers
+	unsigned long long z = baseSeed + 0x9E3779B97F4A7C15ULL *
+		(((unsigned long long) generation * L + layer) * MaxM + index + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (unsigned) (z ^ (z >> 31));
+	}
+
+static inline double uniform(unsigned *state)
+	{
+	return rand_r(state) / (double) RAND_MAX;
+	}
+
+// Draw a new set of samples, shared by all the candidates of a generation
+void drawSamples(int generation)
+	{
+	unsigned state = candidateSeed(generation, 0, 0);
+	for (int i = 0; i < NumTrials; ++i)
+		{
+		double *K = samples[i];
+		// Create random K vector (4 + 2 + 2 elements)
+		for (int k = 0; k < 4; ++k)
+			K[k] = floor(uniform(&state) * 10.0) / 10.0;
+		for (int k = 4; k < 6; ++k)
+			K[k] = uniform(&state) > 0.5 ? 1.0 : 0.0;
+		for (int k = 6; k < 8; ++k)
+			K[k] = floor(uniform(&state) * 10.0) / 10.0;
+		for (int k = 8; k < N; ++k)
+			K[k] = 0.0;
+
+		// Desired value = K_star
+		transition(K, targets[i]);
+		}
+	}
+
+// **** Thread pool
+// The workers sleep until a job is posted;  then each one runs the job on its share of
+// the tasks (contiguous ranges), with its own scratch space.  The posting thread is
+// worker 0.  A task is 1 candidate:  task = (layer - 1) * M + index.
+static struct
+	{
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	pthread_t threads[MaxThreads];
+	GSCRATCH scratch[MaxThreads];
+	int numThreads;
+	int jobNumber;					// incremented for every job posted
+	int busy;						// workers still running the current job
+	GJOB job;
+	int numTasks;
+	bool quit;
+	} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static void runShare(int id)
+	{
+	int first = (long) pool.numTasks * id / pool.numThreads;
+	int last = (long) pool.numTasks * (id + 1) / pool.numThreads;
+	for (int task = first; task < last; ++task)
+		pool.job(&pool.scratch[id], task);
+	}
+
+static void *poolWorker(void *arg)
+	{
+	int id = (int) (long) arg;
+	int seen = 0;
+	while (true)
+		{
+		pthread_mutex_lock(&pool.lock);
+		while (pool.jobNumber == seen && !pool.quit)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		if (pool.quit)
+			{
+			pthread_mutex_unlock(&pool.lock);
+			return NULL;
+			}
+		seen = pool.jobNumber;
+		pthread_mutex_unlock(&pool.lock);
+
+		runShare(id);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.busy == 0)
+			pthread_cond_signal(&pool.done);
+		pthread_mutex_unlock(&pool.lock);
+		}
+	}
+
+// Resize the pool to numThreads workers (including the calling thread)
+void setThreads(int numThreads)
+	{
+	if (numThreads < 1)
+		numThreads = 1;
+	if (numThreads > MaxThreads)
+		numThreads = MaxThreads;
+	if (numThreads == pool.numThreads)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	for (int t = 1; t < pool.numThreads; ++t)
+		pthread_join(pool.threads[t], NULL);
+
+	pool.quit = false;
+	pool.jobNumber = 0;
+	pool.numThreads = numThreads;
+	for (int t = 1; t < numThreads; ++t)
+		pthread_create(&pool.threads[t], NULL, poolWorker, (void *) (long) t);
+	}
+
+// Run job on tasks 0 ... numTasks-1, and wait for all of them to finish
+void runJob(GJOB job, int numTasks)
+	{
+	if (pool.numThreads == 0)
+		setThreads(1);
+
+	pthread_mutex_lock(&pool.lock);
+	pool.job = job;
+	pool.numTasks = numTasks;
+	pool.busy = pool.numThreads - 1;
+	++pool.jobNumber;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	runShare(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy > 0)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	}
+
+// The network made of the first N candidates of each layer of pop
+void topNetwork(double pop[L][MaxM][W], double *net[L][N])
+	{
+	for (int l = 1; l < L; ++l)
+		for (int n = 0; n < N; ++n)
+			net[l][n] = pop[l][n];
+	}
 
 // Perhaps each neuron is an individual, in the sense that neurons compete with each other.
 // The network should consist of the top-N neurons in each population row.
@@ -71,192 +234,387 @@ extern void backprop_gNN(double []);
 
 // For each layer, the fitness of individual neurons can be calculated by choosing that
 // neuron together with the N-1 top-ranking neurons in that layer.  Can this be simplified?
+// A candidate outside of the top N takes the place of the N-th one.
 //
-double fitness(int layer, int index)
-// Call forward-prop with input-output pairs to evaluate the current network.
+double fitness(double pop[L][MaxM][W], GSCRATCH *scratch, int layer, int index)
+// Call forward-prop with the samples' input-output pairs to evaluate the network.
+// Only the local gradients are calculated, the weights are not changed.
 	{
-	// initialize network
-	double K[dimK];
-	double errors[dimK];
+	double *net[L][N];
+	topNetwork(pop, net);
+	net[layer][index < N ? index : N - 1] = pop[layer][index];
 
-	// forward_prop
-	#define NumTrials	100
+	double errors[N];
 	double sum_fitness = 0.0;
 	for (int i = 0; i < NumTrials; ++i)
 		{
-		// prepare input and ideal output values
-		// Create random K vector (4 + 2 + 2 elements)
-		for (int k = 0; k < 4; ++k)
-			K[k] = floor((rand() / (double) RAND_MAX) * 10.0) / 10.0;
-		for (int k = 4; k < 6; ++k)
-			K[k] = (rand() / (double) RAND_MAX) > 0.5 ? 1.0 : 0.0;
-		for (int k = 6; k < 8; ++k)
-			K[k] = floor((rand() / (double) RAND_MAX) * 10.0) / 10.0;
-
-		// Desired value = K_star
-		double K_star[10];
-		extern void transition(double [], double []);
-		transition(K, K_star);
-
-		forward_gNN(dimK, K);		// forward-propagate the gNN
+		forward_gNN(net, scratch, dimK, samples[i]);		// forward-propagate the gNN
 
 		// Calculate the error, for back-prop
-		for (int k = 0; k < dimK; ++k)
-			errors[k] = K_star[k] - K[k];	// error = ideal - actual
+		for (int k = 0; k < N; ++k)
+			errors[k] = targets[i][k] - scratch->output[L - 1][k];	// error = ideal - actual
 
 		// Use back-prop to calculate local gradients
-		backprop_gNN(errors);
+		gradient_gNN(net, scratch, errors);
 		// Then fitness = sum of local gradients for a neuron, relative to 1 example.
 		double fitness = 0.0;
 		for (int n = 0; n < N; ++n)
 			{
-			double g = grad[layer][n];
+			double g = scratch->grad[layer][n];
 			fitness += g * g;
 			}
 		// And we need to add up the fitnesses for all examples.
 		sum_fitness -= fitness;
 		}
+	return sum_fitness;
+	}
+
+// Mean square error of the network made of the top N candidates, on the samples
+double networkError(double pop[L][MaxM][W])
+	{
+	double *net[L][N];
+	topNetwork(pop, net);
+
+	GSCRATCH scratch;
+	double sumOfSquareError = 0.0;
+	for (int i = 0; i < NumTrials; ++i)
+		{
+		forward_gNN(net, &scratch, dimK, samples[i]);
+		for (int k = 0; k < N; ++k)
+			{
+			double error = targets[i][k] - scratch.output[L - 1][k];
+			sumOfSquareError += error * error;
+			}
+		}
+	return sumOfSquareError / (NumTrials * N);
+	}
+
+static double (*evaluated)[MaxM][W];	// the population being evaluated
+
+static inline double *pop_evaluated(int layer, int index)
+	{
+	return evaluated[layer][index];
+	}
+
+// **** Matrix evaluator:  the same fitness, for a block of candidates of 1 layer at once.
+// All the candidates of a layer see the same inputs (the outputs of the top network's
+// lower layers), so the layer's induced local fields for all samples and candidates are
+// 1 product:  (samples × weights) · (weights × candidates).  Above that layer, each
+// candidate's network differs, so the samples of all the candidates in the block are
+// stacked into R = block size × NumTrials rows, and every further layer, forward and
+// backward, is 1 product of the R rows with the top network's weight matrix.
+bool useMatrix = true;				// false = evaluate candidate by candidate
+
+static double topOutput[L][NumTrials][W];	// top network's outputs, [0] = bias input 1
+
+// Forward-prop the samples through the top network, 1 matrix product per layer
+static void topForward(double pop[L][MaxM][W])
+	{
+	static double field[NumTrials][N];
+	for (int i = 0; i < NumTrials; ++i)
+		{
+		topOutput[0][i][0] = BIASOUTPUT;
+		for (int k = 0; k < N; ++k)
+			topOutput[0][i][k + 1] = samples[i][k];
+		}
+	for (int l = 1; l < L; ++l)
+		{
+		cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, NumTrials, N, W,
+			1.0, &topOutput[l - 1][0][0], W, pop[l][0], W, 0.0, &field[0][0], N);
+		for (int i = 0; i < NumTrials; ++i)
+			{
+			topOutput[l][i][0] = BIASOUTPUT;
+			for (int n = 0; n < N; ++n)
+				topOutput[l][i][n + 1] = sigmoid(field[i][n]);
+			}
+		}
+	}
+
+static void evaluateBlockTask(GSCRATCH *scratch, int task)
+	{
+	int blocks = (M + CandBlock - 1) / CandBlock;
+	int layer = task / blocks + 1;
+	int first = (task % blocks) * CandBlock;
+	int count = (M - first < CandBlock) ? M - first : CandBlock;
+	int R = count * NumTrials;		// row r = c * NumTrials + i, for candidate c, sample i
+
+	const int maxR = CandBlock * NumTrials;
+	if (scratch->matrix == NULL)
+		scratch->matrix = (double *) malloc((L * maxR * W + L * maxR * N + maxR * N) * sizeof (double));
+	double *outs[L], *grads[L];		// outs[l] = R × W, with the bias input;  grads[l] = R × N
+	for (int l = 0; l < L; ++l)
+		{
+		outs[l] = scratch->matrix + l * maxR * W;
+		grads[l] = scratch->matrix + L * maxR * W + l * maxR * N;
+		}
+	double *field = scratch->matrix + L * maxR * (W + N);	// R × N
+
+	// The candidates' layer:  top outputs, with the candidate in place of neuron s
+	cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, NumTrials, count, W,
+		1.0, &topOutput[layer - 1][0][0], W, pop_evaluated(layer, first), W, 0.0, field, count);
+	for (int c = 0; c < count; ++c)
+		{
+		int s = (first + c < N) ? first + c : N - 1;
+		for (int i = 0; i < NumTrials; ++i)
+			{
+			double *out = outs[layer] + (c * NumTrials + i) * W;
+			memcpy(out, topOutput[layer][i], W * sizeof (double));
+			out[s + 1] = sigmoid(field[i * count + c]);
+			}
+		}
+
+	// The layers above, with the top network's weights
+	for (int l = layer + 1; l < L; ++l)
+		{
+		cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, R, N, W,
+			1.0, outs[l - 1], W, pop_evaluated(l, 0), W, 0.0, field, N);
+		for (int r = 0; r < R; ++r)
+			{
+			outs[l][r * W] = BIASOUTPUT;
+			for (int n = 0; n < N; ++n)
+				outs[l][r * W + n + 1] = sigmoid(field[r * N + n]);
+			}
+		}
+
+	// Local gradients, as in gradient_gNN(), down to the candidates' layer
+	for (int r = 0; r < R; ++r)
+		for (int n = 0; n < N; ++n)
+			{
+			double out = outs[L - 1][r * W + n + 1];
+			double error = targets[r % NumTrials][n] - out;		// error = ideal - actual
+			grads[L - 1][r * N + n] = steepness * out * (1.0 - out) * error;
+			}
+	for (int l = L - 2; l >= layer; --l)
+		{
+		// ∑_i W_i,n+1 ∇_i of the next layer, ignoring weights[0] = bias
+		cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, R, N, N,
+			1.0, grads[l + 1], N, pop_evaluated(l + 1, 0) + 1, W, 0.0, field, N);
+		for (int r = 0; r < R; ++r)
+			for (int n = 0; n < N; ++n)
+				{
+				double out = outs[l][r * W + n + 1];
+				grads[l][r * N + n] = steepness * out * (1.0 - out) * field[r * N + n];
+				}
+		}
+
+	for (int c = 0; c < count; ++c)
+		{
+		double sum_fitness = 0.0;
+		for (int j = c * NumTrials * N; j < (c + 1) * NumTrials * N; ++j)
+			sum_fitness -= grads[layer][j] * grads[layer][j];
+		score[layer][first + c] = sum_fitness;
+		}
+	}
+
+// **** Evaluation stage:  the fitness of every candidate, exactly once per generation.
+// All candidates are evaluated on the same samples, and against the same top-N network
+// (ie, before any of the scores changes the order).  Then each layer is sorted by score.
+static int sortLayer;
+
+static int compareScore(const void *l, const void *r)
+	{
+	int x = *(const int *) l, y = *(const int *) r;
+	double sx = score[sortLayer][x], sy = score[sortLayer][y];
+	if (sx != sy)
+		return (sx < sy) - (sx > sy);	// highest score first
+	return x - y;						// ties keep their order, so the sort is stable
+	}
+
+
+static void evaluateTask(GSCRATCH *scratch, int task)
+	{
+	int l = task / M + 1, m = task % M;
+	score[l][m] = fitness(evaluated, scratch, l, m);
+	}
+
+void evaluatePopulation(double pop[L][MaxM][W])
+	{
+	evaluated = pop;
+	if (useMatrix)
+		{
+		topForward(pop);
+		runJob(evaluateBlockTask, (L - 1) * ((M + CandBlock - 1) / CandBlock));
+		}
+	else
+		runJob(evaluateTask, (L - 1) * M);
+
+	// Sort population according to fitness
+	static double sorted[MaxM][W];
+	static double sortedScore[MaxM];
+	static int order[MaxM];
+	for (int l = 1; l < L; ++l)		// for each layer
+		{
+		for (int m = 0; m < M; ++m)
+			order[m] = m;
+		sortLayer = l;
+		qsort(order, M, sizeof (int), compareScore);
+
+		for (int m = 0; m < M; ++m)
+			{
+			memcpy(sorted[m], pop[l][order[m]], sizeof sorted[m]);
+			sortedScore[m] = score[l][order[m]];
+			}
+		memcpy(pop[l], sorted, M * sizeof sorted[0]);
+		memcpy(score[l], sortedScore, M * sizeof sortedScore[0]);
+		}
 	}
 
 // This seems to be independent of gene expression
-// INPUT: population
+// INPUT: population, with its scores
 // OUTPUT: selected = the winner (an individual = a neuron)
 void binaryTournament(int layer, int candidate)
 	{
-	// Choose 2 candidates (neurons) in the population
-	int i = (rand() / (double) RAND_MAX) * M;
-	int j = (rand() / (double) RAND_MAX) * M;
+	unsigned *state = &rngState[layer][candidate];
 
-	double *p1 = population[layer][i], *p2 = population[layer][j];
+	// Choose 2 candidates (neurons) in the population
+	int i = rand_r(state) % M;
+	int j = rand_r(state) % M;
 
 	double *p;
-	if (fitness(layer, i) > fitness(layer, j))
-		p = p1;
+	if (score[layer][i] > score[layer][j])
+		p = population[layer][i];
 	else
-		p = p2;
+		p = population[layer][j];
 
-	for (int n = 0; n < N; ++n)
+	for (int n = 0; n < W; ++n)
 		selected[layer][candidate][n] = p[n];
 	}
 
 // Each neuron is an individual, a point mutation mutates a single weight within the neuron
-void pointMutation(double *dna, double rate)
+void pointMutation(double *dna, double rate, unsigned *state)
 	{
-	for (int n = 0; n < N; ++n)
-		if ((rand() / (double) RAND_MAX) < rate)
-			dna[n] = (dna[n] == '0') ? '1' : '0';
+	for (int n = 0; n < W; ++n)
+		if (uniform(state) < rate)
+			dna[n] += (uniform(state) * 2.0 - 1.0) * MutationSize;
 	}
 
 // Cross-over of 2 neurons
-void crossOver(double *result, double *parent1, double *parent2, double rate)
+void crossOver(double *result, double *parent1, double *parent2, double rate, unsigned *state)
 	{
-	if ((rand() / (double) RAND_MAX) > rate)
+	if (uniform(state) > rate)
 		{
-		for (int n = 0; n < N; ++n)
+		for (int n = 0; n < W; ++n)
 			result[n] = parent1[n];
 		return;
 		}
 
-	int point = (rand() / (double) RAND_MAX) * N;
+	int point = rand_r(state) % W;
 	int n;
 	for (n = 0; n < point; ++n)
 		result[n] = parent1[n];
-	for (; n < N; ++n)
+	for (; n < W; ++n)
 		result[n] = parent2[n];
 	}
 
-// **** Reproduce for 1 generation
-void reproduce(int layer, int popSize, double crossRate, double mutationRate)
+// **** Reproduce 1 candidate, from the selected ones
+void reproduce(int layer, int m, int popSize, double crossRate, double mutationRate)
 	{
 	double *p1, *p2;
 
-	for (int m = 0; m < M; ++m)
-		{
-		p1 = selected[layer][m];
-		p2 = (m % 2 == 0) ? selected[layer][m + 1] : selected[layer][m - 1];
-		if (m == M - 1)
-			p2 = selected[layer][0];
+	p1 = selected[layer][m];
+	p2 = (m % 2 == 0) ? selected[layer][m + 1] : selected[layer][m - 1];
+	if (m == popSize - 1)
+		p2 = selected[layer][0];
 
-		crossOver(children[layer][m], p1, p2, crossRate);
-		pointMutation(children[layer][m], mutationRate);
-		}
+	unsigned *state = &rngState[layer][m];
+	crossOver(children[layer][m], p1, p2, crossRate, state);
+	pointMutation(children[layer][m], mutationRate, state);
 	}
 
-void printCandidate(double candidate[N])
+static int currentGen;
+
+static void selectTask(GSCRATCH *scratch, int task)
 	{
-	for (int n = 0; n < N; ++n)
-		printf("%c", (candidate[n] == '0') ? ' ' : '*');
-	printf("\n");
+	int l = task / M + 1, m = task % M;
+	rngState[l][m] = candidateSeed(currentGen, l, m);
+	binaryTournament(l, m);
 	}
 
-// Main algorithm for genetic search
-void evolve()
+static void reproduceTask(GSCRATCH *scratch, int task)
 	{
-	// No need to create neural network as it is stored in the population
-	// initialize population
-	for (int l = 0; l < L; ++l)
-		for (int m = 0; m < M; ++m)
-			for (int n = 0; n < N; ++n)
-				population[l][m][n] = (rand() / (double) RAND_MAX) * 2.0 - 1.0;	// w ∊ [-1,1]
+	reproduce(task / M + 1, task % M, M, CrossRate, MutationRate);
+	}
 
-	// Compare fitness of 2 neurons
-	// The neurons are addressed by layer and position
-	int qsort_layer;
-	int compareFitness(const void *l, const void *r)
-		{
-		int x_index = *(const int *)l;
-		int y_index = *(const int *)r;
-		return (fitness(qsort_layer, x_index) < fitness(qsort_layer, y_index));
-		};
+static void initTask(GSCRATCH *scratch, int task)
+	{
+	int l = task / M + 1, m = task % M;
+	unsigned state = candidateSeed(0, l, m);
+	for (int n = 0; n < W; ++n)
+		population[l][m][n] = uniform(&state) * 2.0 - 1.0;	// w ∊ [-1,1]
+	}
 
-	// Sort population according to fitness
-	for (int l = 0; l < L; ++l)		// for each layer
-		{
-		qsort_layer = l;		// NB: This is required for the comparison function!
-		// size of population is M, size of individual is N
-		// A question is whether the # of connections should be N or M?
-		// It can be N, if the actual network (of width N) is relatively static.
-		qsort(population[l], M, N, compareFitness);
-		}
-	printf("Initial population:\n");
-	for (int l = 0; l < L; ++l)
-		for (int m = 0; m < M; ++m)
-			{
-			printCandidate(population[l][m]);
-			}
+// No need to create neural network as it is stored in the population
+void initPopulation()
+	{
+	runJob(initTask, (L - 1) * M);
+	drawSamples(0);
+	evaluatePopulation(population);
+	}
 
-	for (int i = 0; i < MaxGens; ++i)
-		{
-		printf("gen %03d: \n", i);
+// 1 generation:  selection, reproduction, and evaluation of the new population
+void nextGeneration(int generation)
+	{
+	currentGen = generation;
+	runJob(selectTask, (L - 1) * M);		// all the selections must finish before
+	runJob(reproduceTask, (L - 1) * M);		// the children are made
+	for (int l = 1; l < L; ++l)
+		memcpy(population[l], children[l], M * sizeof children[l][0]);
+
+	// The only fitness evaluations of the generation
+	drawSamples(generation);
+	evaluatePopulation(population);
+	}
 
-		for (int l = 0; l < L; ++l)			// for each layer
-			for (int m = 0; m < M; ++m)		// for each candidate in population
-				binaryTournament(l, m);
+// Signs of the weights, and the score
+void printCandidate(double candidate[W], double fitness)
+	{
+	for (int n = 0; n < W; ++n)
+		printf("%c", (candidate[n] > 0.0) ? '+' : '-');
+	printf("  %.4f\n", fitness);
+	}
 
-		for (int l = 0; l < L; ++l)		// for each layer
-			{
-			qsort_layer = l;			// NB: This is required for the comparison function!
-			qsort(selected[l], M, N, compareFitness);
-			}
+static double now()
+	{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+	}
 
-		for (int l = 0; l < L; ++l)			// for each layer
-			reproduce(l, M, CrossRate, MutationRate);
+static int hardwareThreads()
+	{
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n < 1) ? 1 : n;
+	}
 
-		for (int l = 0; l < L; ++l)		// for each layer
+// Main algorithm for genetic search
+void evolve()
+	{
+	setThreads(hardwareThreads());
+	initPopulation();
+	printf("Initial population:\n");
+	for (int l = 1; l < L; ++l)
+		for (int m = 0; m < M; ++m)
 			{
-			qsort_layer = l;			// NB: This is required for the comparison function!
-			qsort(children[l], M, N, compareFitness);
+			printCandidate(population[l][m], score[l][m]);
 			}
 
-		for (int l = 0; l < L; ++l)
+	double seconds = 0.0;			// time spent evolving, excluding the output
+	for (int i = 1; i <= MaxGens; ++i)
+		{
+		double start = now();
+		nextGeneration(i);
+		double error = networkError(population);
+		seconds += now() - start;
+
+		printf("gen %03d: error = %.5f (%.1f generations/sec)\n", i, error, i / seconds);
+		for (int l = 1; l < L; ++l)
 			for (int m = 0; m < M; ++m)
 				{
-				printCandidate(children[l][m]);
+				printCandidate(population[l][m], score[l][m]);
 				}
 
-		strncpy(population, children, sizeof(population));
-
-		if (fitness(best, 0) >= N)
+		#define SuccessError	0.001
+		if (error < SuccessError)
 			{
 			printf("Success!!!\n");
 			break;
@@ -269,11 +627,64 @@ void evolve()
 	printf("Finished.\n");
 	}
 
+// **** Scaling test:  the same evolution with populations of 10 to 10k and 1 to N threads,
+// evaluated candidate by candidate and as matrices.
+// The scores after the last generation must be the same for any number of threads.
+void evolve_scaling_test()
+	{
+	static double score1[L][MaxM];		// the scores with 1 thread
+	const int sizes[] = {10, 100, 1000, 10000};
+	int maxThreads = hardwareThreads();
+
+	printf("     M  evaluator  threads   generations/sec   candidates/sec  speedup  same scores\n");
+	for (int s = 0; s < 4; ++s)
+		{
+		M = sizes[s];
+		int gens = 20000 / M;			// about the same work for every size
+		if (gens < 3)
+			gens = 3;
+
+		double base = 0.0;
+		for (int matrix = 0; matrix < 2; ++matrix)
+			{
+			useMatrix = matrix;
+			for (int t = 1; ; t = (t * 2 < maxThreads) ? t * 2 : maxThreads)
+				{
+				setThreads(t);
+				initPopulation();
+				double start = now();
+				for (int i = 1; i <= gens; ++i)
+					nextGeneration(i);
+				double rate = gens / (now() - start);
+
+				bool same = true;
+				if (t == 1)
+					{
+					if (!matrix)
+						base = rate;
+					memcpy(score1, score, sizeof score);
+					}
+				else
+					for (int l = 1; l < L; ++l)
+						same = same && memcmp(score1[l], score[l], M * sizeof (double)) == 0;
+
+				printf("%6d  %9s %8d %17.1f %16.0f %8.2f  %s\n", M, matrix ? "matrix" : "loop", t,
+					rate, rate * (L - 1) * M, rate / base, same ? "yes" : "NO");
+				if (t == maxThreads)
+					break;
+				}
+			}
+		}
+	M = 20;
+	useMatrix = true;
+	}
+
 
 //**************************** forward-propagation ***************************//
-void forward_gNN(int dim_V, double V[])
+// net[l][n] = weights of the n-th neuron in layer l
+void forward_gNN(double *net[L][N], GSCRATCH *scratch, int dim_V, double V[])
 	{
-	// extern double output[][];
+	double (*output)[N] = scratch->output;
 
 	// set the output of input layer
 	for (int n = 0; n < dim_V; ++n)
@@ -284,16 +695,11 @@ void forward_gNN(int dim_V, double V[])
 		{
 		for (int n = 0; n < N; n++)
 			{
-			double v = 0; //induced local field for neurons
+			double *weights = net[l][n];
+			double v = weights[0] * BIASOUTPUT; //induced local field for neurons
 			// calculate v, which is the sum of the product of input and weights
-			for (int k = 0; k <= N; k++)
-				{
-				if (k == 0)
-					v += population[l][n][k] * BIASOUTPUT;
-				else
-					v += population[l][n][k] *
-						output[l - 1][k - 1];
-				}
+			for (int k = 1; k <= N; k++)
+				v += weights[k] * output[l - 1][k - 1];
 
 			output[l][n] = sigmoid(v);
 			}
@@ -310,14 +716,17 @@ void forward_gNN(int dim_V, double V[])
 // "local gradient" keeps changing.  I have a hypothesis that ∇ will fluctuate wildly
 // when the NN topology is "inadequate" to learn the target function.
 
-void backprop_gNN(double *errors)
+// Local gradients only, without changing the weights
+void gradient_gNN(double *net[L][N], GSCRATCH *scratch, double *errors)
 	{
+	double (*output)[N] = scratch->output;
+	double (*grad)[N] = scratch->grad;
+
 	// calculate gradient for output layer
 	for (int n = 0; n < N; ++n)
 		{
 		double out = output[L - 1][n];
 		//for output layer, ∇ = y∙(1-y)∙error
-		#define steepness 1.0
 		grad[L - 1][n] = steepness * out * (1.0 - out) * errors[n];
 		}
 
@@ -331,25 +740,30 @@ void backprop_gNN(double *errors)
 			// nextLayer = l + 1;
 			for (int i = 0; i < N; i++)		// for each weight
 				{
-				sum += population[l + 1][i][n + 1]		// ignore weights[0] = bias
+				sum += net[l + 1][i][n + 1]		// ignore weights[0] = bias
 						* grad[l + 1][i];
 				}
 			grad[l][n] = steepness * out * (1.0 - out) * sum;
 			}
 		}
+	}
+
+void backprop_gNN(double *net[L][N], GSCRATCH *scratch, double *errors)
+	{
+	gradient_gNN(net, scratch, errors);
 
 	// update all weights
 	for (int l = 1; l < L; ++l)		// except for 0th layer which has no weights
 		{
 		for (int n = 0; n < N; n++)		// for each neuron
 			{
-			population[l][n][0] += Eta *
-					grad[l][n] * 1.0;		// 1.0f = bias input
+			net[l][n][0] += Eta *
+					scratch->grad[l][n] * 1.0;		// 1.0f = bias input
 			for (int i = 0; i < N; i++)		// for each weight
 				{
-				double inputForThisNeuron = output[l - 1][i];
-				population[l][n][i + 1] += Eta *
-						grad[l][n] * inputForThisNeuron;
+				double inputForThisNeuron = scratch->output[l - 1][i];
+				net[l][n][i + 1] += Eta *
+						scratch->grad[l][n] * inputForThisNeuron;
 				}
 			}
 		}
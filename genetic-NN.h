@@ -0,0 +1,38 @@
+// Shared by genetic-NN.c and the files that drive its population or its thread pool
+// (genetic-NN-islands.c, Fourier-genetic-NN.c), so that they all agree on the layout
+// of the population arrays.
+
+#ifndef GENETIC_NN_H
+#define GENETIC_NN_H
+
+#define L				4		// L = number of layers
+#define N				10		// N = number of neurons per layer = dim K
+#define MaxM			10000	// max number of "candidate" neurons per layer
+#define W				(N + 1)	// weights per neuron, weights[0] = bias
+
+// Scratch space for forward- and back-prop;  1 per thread, so that the candidates can be
+// evaluated concurrently
+typedef struct GSCRATCH
+	{
+	double output[L][N];			// output of each neuron
+	double grad[L][N];				// local gradient for each neuron
+	double *matrix;					// buffers of the matrix evaluator, allocated on first use
+	} GSCRATCH;
+
+// A job of the thread pool, run once for every task
+typedef void (*GJOB)(GSCRATCH *, int task);
+
+// ******** Globals and functions of genetic-NN.c
+extern int M;						// M = number of "candidate" neurons per layer; M ≥ N
+extern unsigned baseSeed;
+extern double population[L][MaxM][W];
+
+extern void setThreads(int numThreads);
+extern void runJob(GJOB job, int numTasks);
+extern void initPopulation();
+extern void nextGeneration(int generation);
+extern void drawSamples(int generation);
+extern void evaluatePopulation(double pop[L][MaxM][W]);
+extern double networkError(double pop[L][MaxM][W]);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 
 #include "feedforward-NN.h"
@@ -99,31 +101,21 @@ double state[9] = {		// state of Tic-Tac-Toe
 
 bool won(double who)		// check if player has won
 	{
-	// total of 8 cases:
+	// total of 8 cases, as bitmasks of the squares:
 	// 0 1 2
 	// 3 4 5
 	// 6 7 8
+	static const int lines[8] = {0007, 0070, 0700, 0111, 0222, 0444, 0421, 0124};
 
-	#define TAKEN(x)		((x - who) < 0.01)
+	#define TAKEN(x)		(fabs((x) - who) < 0.01)
 
-	if (TAKEN(state[0]) && TAKEN(state[1]) && TAKEN(state[2]))
-		return true;
-	if (TAKEN(state[3]) && TAKEN(state[4]) && TAKEN(state[5]))
-		return true;
-	if (TAKEN(state[6]) && TAKEN(state[7]) && TAKEN(state[8]))
-		return true;
+	int taken = 0;			// squares taken by player
+	for (int i = 0; i < 9; ++i)
+		taken |= TAKEN(state[i]) << i;
 
-	if (TAKEN(state[0]) && TAKEN(state[3]) && TAKEN(state[6]))
-		return true;
-	if (TAKEN(state[1]) && TAKEN(state[4]) && TAKEN(state[7]))
-		return true;
-	if (TAKEN(state[2]) && TAKEN(state[5]) && TAKEN(state[8]))
-		return true;
-
-	if (TAKEN(state[0]) && TAKEN(state[4]) && TAKEN(state[8]))
-		return true;
-	if (TAKEN(state[2]) && TAKEN(state[4]) && TAKEN(state[6]))
-		return true;
+	for (int l = 0; l < 8; ++l)
+		if ((taken & lines[l]) == lines[l])
+			return true;
 
 	return false;
 	}
@@ -265,16 +257,33 @@ extern void RNN_sine_test();
 extern void BPTT_arithmetic_test();
 extern void BPTT_arithmetic_testB();
 extern void evolve();
+extern void evolve_scaling_test();
+extern void Fourier_evolve();
+extern double evolve_islands(int numIslands, int interval, int maxGens);
+extern void island_evolve();
 extern void main2();
 extern void jacobian_test();
 extern void Q_test();
 extern void tic_tac_toe_test();
 extern void tic_tac_toe_test3();
 extern void tic_tac_toe_test4();
+extern void Q_replay_benchmark();
+extern void self_play_benchmark();
+extern void game_scheduler_benchmark();
+extern void mcts_benchmark();
 extern void symmetric_test();
 
 int main(int argc, char** argv)
 	{
+	// Headless:  genifer islands [islands [interval [generations]]]
+	if (argc > 1 && strcmp(argv[1], "islands") == 0)
+		{
+		int numIslands = (argc > 2) ? atoi(argv[2]) : 0;		// 0 = 1 per core
+		int interval = (argc > 3) ? atoi(argv[3]) : 10;
+		int maxGens = (argc > 4) ? atoi(argv[4]) : 1000;
+		return evolve_islands(numIslands, interval, maxGens) < 0.0;
+		}
+
 	bool quit = false;
 	printf("\n\n*** Welcome to Genifer 5.4 ***\n\n");
 
@@ -300,7 +309,14 @@ int main(int argc, char** argv)
 		printf("[h] run maze\n");
 		printf("[i] symmetric NN test \n");
 		printf("[j] Jacobian NN\n");
+		printf("[k] Tic-Tac-Toe: coroutine games with batched NN evaluations\n");
+		printf("[l] genetic NN: parallel evaluation scaling test\n");
+		printf("[m] Tic-Tac-Toe: Monte Carlo Tree Search player\n");
+		printf("[n] Fourier genetic NN: batched FFTW decoding\n");
+		printf("[o] genetic NN: island model, 1 population per core\n");
 		printf("[q] * Q-learning test\n");
+		printf("[r] Tic-Tac-Toe Q-learning: experience replay benchmark\n");
+		printf("[s] Tic-Tac-Toe multi-threaded self-play benchmark\n");
 		printf("[t] Tic-Tac-Toe (Sayaka 2 architecture)\n");
 		printf("[u] Tic-Tac-Toe (Sayaka 1 architecture)\n");
 		printf("[v] Tic-Tac-Toe (V-value architecture)\n");
@@ -370,9 +386,30 @@ int main(int argc, char** argv)
 			case 'j':
 				// jacobian_test(); // test Jacobian neural network
 				break;
+			case 'k':
+				game_scheduler_benchmark();
+				break;
+			case 'l':
+				evolve_scaling_test();
+				break;
+			case 'm':
+				mcts_benchmark();
+				break;
+			case 'n':
+				Fourier_evolve();
+				break;
+			case 'o':
+				island_evolve();
+				break;
 			case 'q':
 				// Q_test(); // test Q learning
 				break;
+			case 'r':
+				Q_replay_benchmark();
+				break;
+			case 's':
+				self_play_benchmark();
+				break;
 			case 't':
 				tic_tac_toe_test4();
 				break;
@@ -0,0 +1,189 @@
+// Exact minimax values of tic-tac-toe, as an oracle for scoring the learned players.
+
+// The value of a position is the outcome under optimal play from both sides, from
+// player 1's point of view:  1 = player 1 wins, -1 = player -1 wins, 0 = draw.  It depends
+// on the board and on the side to move, and is the same for symmetric boards, so the
+// transposition table is indexed by [side to move][canonTable.id].  All 2 × 2862 entries are
+// solved once, and saved to minimax.tt;  later runs just read the file.
+
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <cstring>		// memcmp
+#include <vector>
+#include <functional>
+#include <chrono>
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+// ******** Functions from tic-tac-toe.cpp
+extern State board;
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int hasWinner(const State &s);
+
+#define Unsolved	((signed char) 127)
+
+static signed char table[2][NumCanon];		// [0] = player 1 to move, [1] = player -1
+static bool solved = false;
+
+static const char ttFileName[] = "minimax.tt";
+static const char ttMagic[8] = {'T', 'T', 'T', 'M', 'M', 'A', 'X', '1'};
+
+// Value of s with player to move
+static int solve(const State &s, int player)
+	{
+	signed char &entry = table[player == 1 ? 0 : 1][canonTable.id[stateIndex(s)]];
+	if (entry != Unsolved)
+		return entry;
+
+	int won = hasWinner(s);
+	int value;
+	if (won == -2)
+		value = 0;
+	else if (won != 0)
+		value = won;
+	else
+		{
+		// player 1 maximizes, player -1 minimizes
+		int moves[9];
+		State next[9];
+		int n = legalMoves(s, player, moves, next);
+		value = -player;
+		for (int m = 0; m < n && value != player; ++m)
+			{
+			int v = solve(next[m], -player);
+			if (v * player > value * player)
+				value = v;
+			}
+		}
+	entry = value;
+	return value;
+	}
+
+static bool loadTable()
+	{
+	FILE *fp = fopen(ttFileName, "rb");
+	if (fp == NULL)
+		return false;
+
+	char magic[8];
+	bool ok = fread(magic, sizeof magic, 1, fp) == 1 && memcmp(magic, ttMagic, sizeof magic) == 0
+		&& fread(table, sizeof table, 1, fp) == 1;
+	fclose(fp);
+	return ok;
+	}
+
+static void saveTable()
+	{
+	string tmpName = string(ttFileName) + ".tmp";
+	FILE *fp = fopen(tmpName.c_str(), "wb");
+	if (fp == NULL)
+		return;
+	bool ok = fwrite(ttMagic, sizeof ttMagic, 1, fp) == 1 && fwrite(table, sizeof table, 1, fp) == 1;
+	if (fclose(fp) != 0 || !ok || rename(tmpName.c_str(), ttFileName) != 0)
+		remove(tmpName.c_str());
+	}
+
+void init_minimax()
+	{
+	if (solved)
+		return;
+
+	auto start = chrono::steady_clock::now();
+	bool cached = loadTable();
+	if (!cached)
+		{
+		for (int p = 0; p < 2; ++p)
+			for (int c = 0; c < NumCanon; ++c)
+				table[p][c] = Unsolved;
+		for (int c = 0; c < NumCanon; ++c)
+			{
+			solve(canonTable.board[c], 1);
+			solve(canonTable.board[c], -1);
+			}
+		saveTable();
+		}
+	solved = true;
+
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	printf("Minimax table %s in %.2f ms\n", cached ? "read" : "solved", ms);
+	}
+
+// Value of s with player to move
+int minimaxValue(const State &s, int player)
+	{
+	init_minimax();
+	return table[player == 1 ? 0 : 1][canonTable.id[stateIndex(s)]];
+	}
+
+// Is move (a blank square) optimal for player in s?
+bool optimalMove(const State &s, int player, int move)
+	{
+	State next = s;
+	next.set(move, player);
+	return minimaxValue(next, -player) == minimaxValue(s, player);
+	}
+
+// All positions reachable in games starting with either player, where player is to move
+// and the game is not over;  1 per symmetry class.
+static vector<State> positionsToMove(int player)
+	{
+	static vector<State> positions[2];
+	vector<State> &result = positions[player == 1 ? 0 : 1];
+	if (!result.empty())
+		return result;
+
+	vector<bool> seen(2 * NumCanon, false);
+	function<void (const State &, int)> visit = [&](const State &s, int toMove)
+		{
+		int key = (toMove == 1 ? 0 : NumCanon) + canonTable.id[stateIndex(s)];
+		if (seen[key] || hasWinner(s) != 0)
+			return;
+		seen[key] = true;
+		if (toMove == player)
+			result.push_back(canonical(s));
+
+		int moves[9];
+		State next[9];
+		int n = legalMoves(s, toMove, moves, next);
+		for (int m = 0; m < n; ++m)
+			visit(next[m], -toMove);
+		};
+	visit(State(), 1);
+	visit(State(), -1);
+	return result;
+	}
+
+// **** Score a player's move function, move-by-move against optimal play.
+// mover() is called with the global board set to every reachable position where player is
+// to move.  A move is optimal if it keeps the minimax value;  any other move gives away a
+// win or a draw.  Returns the fraction of optimal moves.
+double scoreMover(const char *name, int player, function<int ()> mover)
+	{
+	init_minimax();
+	vector<State> positions = positionsToMove(player);
+
+	State saved = board;
+	int optimal = 0, nonOptimal = 0, illegal = 0;
+	for (State &s : positions)
+		{
+		board = s;
+		int move = mover();
+		if (move < 0 || move > 8 || !(s.blanks() & (1 << move)))
+			{
+			++illegal;
+			continue;
+			}
+		if (optimalMove(s, player, move))
+			++optimal;
+		else
+			++nonOptimal;
+		}
+	board = saved;
+
+	double score = optimal / (double) positions.size();
+	printf("%s:  %.1f%% optimal moves, %d non-optimal, %d illegal, in %zu positions\n",
+		name, score * 100.0, nonOptimal, illegal, positions.size());
+	return score;
+	}
@@ -4,6 +4,7 @@
 #include <algorithm>		// random_shuffle
 #include <math.h>
 #include "feedforward-NN.h"
+#include "set-distance.h"
 
 using namespace std;
 
@@ -70,23 +71,10 @@ double distance_Eu(double x[], double y[])
 // 1) The distance should be 0 under permutations
 // 2) The distance attains its maximum when 2 points are most dissimilar, and would equal the
 //		Euclidean distance between them.
+// (Computed from the moments Σx, Σx², Σy, Σy², see set-distance.h)
 double set_distance(double x[], double y[])
 	{
-	double sum, sum1, sum2 = 0.0;
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum += pow(x[i] - y[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum1 += pow(x[i] - x[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum2 += pow(y[i] - y[j], 2);
-
-	return (2 * sqrt(sum / N) - sqrt(sum1 / N) - sqrt(sum2 / N)) / 2;
+	return set_distance_moments(N, set_moments(N, x), set_moments(N, y));
 	}
 
 // ***** This miraculously good-looking function was found by serendipity
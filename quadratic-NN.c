@@ -18,12 +18,13 @@ double randomWeight()		// generate random weight between [+1.0, -1.0]
 	}
 
 //****************************create neural network*********************//
-// GIVEN: how many layers, and how many neurons in each layer
-QNET *create_QNN(int numLayers)
+// GIVEN: how many layers, and the dimension of every layer
+QNET *create_QNN(int numLayers, int dim_V)
 	{
 	QNET *net = (QNET *) malloc(sizeof (QNET));
 	srand(time(NULL));
 	net->numLayers = numLayers;
+	net->dim_V = dim_V;
 
 	assert(numLayers >= 3);
 
@@ -77,8 +78,18 @@ void free_QNN(QNET *net)
 // (dim_V + 1), with the matrix's index 0 reserved for the constant term (ie, the "bias term"
 // ≡ 1.0).  But the network vector's index 0 would multiply with the matrix index 1.
 
+// Each output is v_n = Σ_ij W_nij x_i x_j, but W has only 4 distinct values:
+//		W_nnn = α,  W_nii = β (i ≠ n),  W_nni = W_nin = γ (i ≠ n),  W_nij = δ (otherwise)
+// So with the sums S = Σ_i x_i and Q = Σ_i x_i² of the layer's inputs:
+//		v_n = α x_n² + β (Q - x_n²) + 2γ x_n (S - x_n) + δ (S² - Q - 2 x_n (S - x_n))
+//			= a x_n² + c S x_n + b Q + δ S²
+// where a = α - β - 2γ + 2δ, b = β - δ, c = 2(γ - δ).  This takes O(dim_V) per layer,
+// instead of O(dim_V³) for the full sum.
+
 void forward_prop_quadratic(QNET *net, double V[])
 	{
+	int dim_V = net->dim_V;
+
 	// set the output of input layer
 	for (int i = 0; i < dim_V; ++i)
 		net->layers[0].neurons[i].output = V[i];
@@ -86,40 +97,28 @@ void forward_prop_quadratic(QNET *net, double V[])
 	// calculate output from hidden layers to output layer
 	for (int l = 1; l < net->numLayers; l++)
 		{
-		// the indices n, i, j are for the matrix W
+		LAYER *layer = &net->layers[l];
+		NEURON *inputs = net->layers[l - 1].neurons;
+
+		double S = 0.0, Q = 0.0;
+		for (int i = 0; i < dim_V; i++)
+			{
+			double x = inputs[i].output;
+			S += x;
+			Q += x * x;
+			}
+		layer->S = S;
+		layer->Q = Q;
+
+		double a = layer->alpha - layer->beta - 2.0 * (layer->gamma - layer->delta);
+		double cS = 2.0 * (layer->gamma - layer->delta) * S;
+		double common = (layer->beta - layer->delta) * Q + layer->delta * S * S;
 		for (int n = 0; n < dim_V; n++)
 			{
-			double v = 0.0;	// "induced local field" of neurons (not sure why this terminology)
-			// calculate v, the sum of product of input and weights
-			for (int i = 0; i < dim_V; i++)
-				for (int j = 0; j < dim_V; j++)
-					{
-					double input1, input2;
-					input1 = net->layers[l-1].neurons[i].output;
-				 	input2 = net->layers[l-1].neurons[j].output;
-
-					double weight;
-					LAYER layer = net->layers[l];
-					if (i == j)				// W[n,i,j] is on diagonal
-						{
-						if (n == i)			// W[n,i,j] is on super-diagonal
-							weight = layer.alpha;
-						else
-							weight = layer.beta;
-						}
-					else					// off diagonal
-						{
-						if (n == i || n == j)
-							weight = layer.gamma;
-						else
-							weight = layer.delta;
-						}
-					v += weight * input1 * input2;
-					}
-
-			net->layers[l].neurons[n].output = v;
+			double x = inputs[n].output;
+			layer->neurons[n].output = (a * x + cS) * x + common;
 			// No need to calculate the traditional "local gradient" because it ≡ 1.0
-			net->layers[l].neurons[n].grad = 1.0;
+			layer->neurons[n].grad = 1.0;
 			}
 		}
 	}
@@ -154,62 +153,77 @@ It was in 1974-1986 that Paul Werbos, David Rumelhart, Geoffrey Hinton and Ronal
 discovered this algorithm for neural networks, although it has been described by
 Bryson, Denham, and Dreyfus in 1963 and by Bryson and Yu-Chi Ho in 1969 as a solution to
 optimization problems.  The book "Talking Nets" interviewed some of these people.
+
+With the closed form of forward-prop, v_n = a x_n² + c S x_n + b Q + δ S², the sums over
+the layer's neurons are also O(dim_V).  With D = Σ_n δ_n and P = Σ_n δ_n x_n:
+	δ_k(of the input) = Σ_n δ_n ∂v_n/∂x_k = 2a δ_k x_k + c (δ_k S + P) + 2b D x_k + 2δ D S
+and the 4 weights change by η Σ_n δ_n ∂v_n/∂W, ie:
+	Δα = η Σ δ_n x_n²,  Δβ = η Σ δ_n (Q - x_n²),
+	Δγ = η Σ δ_n 2x_n (S - x_n),  Δδ = η Σ δ_n (S² - Q - 2x_n (S - x_n))
 */
 void back_prop_quadratic(QNET *net, double *errors)
 	{
 	int numLayers = net->numLayers;
+	int dim_V = net->dim_V;
 	LAYER lastLayer = net->layers[numLayers - 1];
 
 	// calculate gradient for output layer
 	for (int n = 0; n < dim_V; ++n)
 		{
-		// double output = lastLayer.neurons[n].output;
-		// For output layer, ∇ = sign(y)∙error
-		// .grad has been prepared in forward-prop
+		// The output layer is linear, so ∇ = error
 		lastLayer.neurons[n].grad = errors[n];
 		}
 
-	// calculate gradient for hidden layers
+	// calculate gradient for hidden layers, before any weight changes
 	for (int l = numLayers - 2; l > 0; --l)		// for each hidden layer
 		{
-		for (int n = 0; n < dim_V; n++)			// for each neuron in layer
+		LAYER *nextLayer = &net->layers[l + 1];
+		NEURON *neurons = net->layers[l].neurons;	// the inputs of nextLayer
+
+		double D = 0.0, P = 0.0;
+		for (int n = 0; n < dim_V; n++)
+			{
+			double grad = nextLayer->neurons[n].grad;
+			D += grad;
+			P += grad * neurons[n].output;
+			}
+
+		double S = nextLayer->S;
+		double a = nextLayer->alpha - nextLayer->beta - 2.0 * (nextLayer->gamma - nextLayer->delta);
+		double b = nextLayer->beta - nextLayer->delta;
+		double c = 2.0 * (nextLayer->gamma - nextLayer->delta);
+		double common = c * P + 2.0 * nextLayer->delta * D * S;
+		for (int k = 0; k < dim_V; k++)			// for each neuron in layer
 			{
-			// double output = net->layers[l].neurons[n].output;
-			double sum = 0.0f;
-			LAYER nextLayer = net->layers[l + 1];
-			for (int i = 0; i < dim_V; ++i)		// for each weight
-				for (int j = 0; j < dim_V; ++j)
-					{
-					double weight = 1.0;
-					// sum += nextLayer.neurons[i].weights[n + 1]		// ignore weights[0] = bias
-					//		* nextLayer.neurons[i].grad;
-					sum += weight * nextLayer.neurons[i].grad;
-					}
-			// .grad has been prepared in forward-prop
-			net->layers[l].neurons[n].grad = sum;
+			double grad = nextLayer->neurons[k].grad;
+			double x = neurons[k].output;
+			neurons[k].grad = 2.0 * a * grad * x + c * grad * S + 2.0 * b * D * x + common;
 			}
 		}
 
 	// update all weights
 	for (int l = 1; l < numLayers; ++l)		// except for 0th layer which has no weights
 		{
+		LAYER *layer = &net->layers[l];
+		NEURON *inputs = net->layers[l - 1].neurons;
+		double S = layer->S, Q = layer->Q;
+
+		double dAlpha = 0.0, dBeta = 0.0, dGamma = 0.0, dDelta = 0.0;
 		for (int n = 0; n < dim_V; n++)		// for each neuron
 			{
-			double weight;
-			weight += Eta * net->layers[l].neurons[n].grad * 1.0;
-			// net->layers[l].neurons[n].weights[0] += Eta *
-			//		net->layers[l].neurons[n].grad * 1.0;		// 1.0f = bias input
-			for (int i = 0; i < dim_V; ++i)						// for each weight
-				for (int j = 0; j < dim_V; ++j)
-					{
-					double o_i = net->layers[l - 1].neurons[i].output;
-					double o_j = net->layers[l - 1].neurons[j].output;
-					double weight;
-					weight += Eta * net->layers[l].neurons[n].grad * o_i * o_j;
-					// net->layers[l].neurons[n].weights[i + 1] += Eta *
-					//		net->layers[l].neurons[n].grad * inputForThisNeuron;
-					}
+			double grad = layer->neurons[n].grad;
+			double x = inputs[n].output;
+			double x2 = x * x;
+			double cross = 2.0 * x * (S - x);		// Σ of x_i x_j over i ≠ j with n ∊ {i, j}
+			dAlpha += grad * x2;
+			dBeta += grad * (Q - x2);
+			dGamma += grad * cross;
+			dDelta += grad * (S * S - Q - cross);
 			}
+		layer->alpha += Eta * dAlpha;
+		layer->beta += Eta * dBeta;
+		layer->gamma += Eta * dGamma;
+		layer->delta += Eta * dDelta;
 		}
 	}
 
@@ -221,6 +235,7 @@ double calc_error(QNET *net, double Y[], double *errors)
 	double sumOfSquareError = 0;
 
 	int numLayers = net->numLayers;
+	int dim_V = net->dim_V;
 	LAYER lastLayer = net->layers[numLayers - 1];
 	// This means each output neuron corresponds to a classification label --YKY
 	for (int n = 0; n < dim_V; n++)
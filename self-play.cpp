@@ -0,0 +1,256 @@
+// Multi-threaded self-play of tic-tac-toe, with value tables for both players.
+// Player 1 plays greedily on V1, player -1 on V2, and both learn by Bellman updates
+// V(s) += α (V(s') - V(s)) as in tic_tac_toe_test.
+
+// The games of an epoch are sharded over a pool of workers.  Each worker has its own
+// board and PRNG, and plays against a snapshot of V1 / V2 that is read-only during the
+// epoch.  Instead of changing the tables, a worker accumulates its Bellman targets V(s')
+// per canonical board, in thread-local arrays.  At the end of the epoch these are merged:
+// a board visited n times moves by 1 - (1-α)^n of the way to its mean target, which is
+// what n serial updates towards a fixed target would do.  So the learner does not depend
+// on the number of workers, only on the epoch size.
+
+#include <iostream>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <math.h>		// pow
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+// ******** Functions from tic-tac-toe.cpp and V-table.cpp
+extern int legalMoves(const State &s, int player, int moves[9], State next[9]);
+extern int argmaxMove(int n, int moves[9], double values[9]);
+extern int hasWinner(const State &s);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+extern int greedyMove(VTable &V, int player);
+
+// ******** Functions from minimax.cpp
+extern double scoreMover(const char *name, int player, std::function<int ()> mover);
+
+extern "C" // functions from visualization.c
+	{
+	void beep();
+	}
+
+#define alpha			0.01		// learning rate of Bellman updates, as in BellmanUpdate()
+#define exploreRate		0.1
+
+struct Worker
+	{
+	State board;
+	std::mt19937 rng;
+	std::uniform_real_distribution<double> uniform;
+
+	// thread-local Bellman targets, for V1 (player 1) and V2 (player -1)
+	double sumTarget[2][NumCanon];
+	int visits[2][NumCanon];
+	vector<int> touched[2];			// the boards with visits > 0
+
+	int games;
+	int wins1, wins_1, draws;
+	};
+
+// Bellman update of V(s) towards V(s2), deferred to the end of the epoch
+static inline void deferUpdate(Worker &w, int p, const VTable &V, const State &s2, const State &s)
+	{
+	int c = canonTable.id[stateIndex(s)];
+	w.sumTarget[p][c] += V.v[canonTable.id[stateIndex(s2)]];
+	if (w.visits[p][c]++ == 0)
+		w.touched[p].push_back(c);
+	}
+
+// Play 1 game on the worker's own board, returns the winner (1 or -1) or 0 for a draw
+static int playGame(Worker &w, const VTable &V1, const VTable &V2)
+	{
+	w.board = State();
+	int player = (w.uniform(w.rng) > 0.5) ? 1 : -1;
+
+	State prev[2];					// last state after each player's move, 0 = player 1
+
+	while (true)
+		{
+		int p = (player == 1) ? 0 : 1;
+		const VTable &V = (player == 1) ? V1 : V2;
+
+		int moves[9];
+		State next[9];
+		int n = legalMoves(w.board, player, moves, next);
+
+		int m;
+		if (w.uniform(w.rng) <= exploreRate)
+			m = (int) (w.uniform(w.rng) * n) % n;
+		else
+			{
+			double values[9];
+			for (int k = 0; k < n; ++k)
+				values[k] = V.v[canonTable.id[stateIndex(next[k])]];
+			int move = argmaxMove(n, moves, values);
+			for (m = 0; moves[m] != move; ++m)
+				;
+			deferUpdate(w, p, V, next[m], prev[p]);
+			}
+		w.board = next[m];
+		prev[p] = w.board;
+
+		int won = hasWinner(w.board);
+		if (won != 0)
+			{
+			// the other player learns the outcome too
+			const VTable &V_other = (player == 1) ? V2 : V1;
+			deferUpdate(w, 1 - p, V_other, w.board, prev[1 - p]);
+			return (won == -2) ? 0 : won;
+			}
+
+		player = -player;
+		}
+	}
+
+static void workerGames(Worker *w, int numGames, const VTable *V1, const VTable *V2)
+	{
+	for (int g = 0; g < numGames; ++g)
+		{
+		int winner = playGame(*w, *V1, *V2);
+		if (winner == 1)
+			++w->wins1;
+		else if (winner == -1)
+			++w->wins_1;
+		else
+			++w->draws;
+		++w->games;
+		}
+	}
+
+// Merge the workers' targets into the tables
+static void mergeUpdates(vector<Worker *> &workers, VTable &V1, VTable &V2)
+	{
+	static double sum[NumCanon];
+	static int n[NumCanon];
+	VTable *tables[2] = {&V1, &V2};
+	for (int p = 0; p < 2; ++p)
+		{
+		vector<int> touched;
+		for (Worker *w : workers)
+			{
+			for (int c : w->touched[p])
+				{
+				if (n[c] == 0)
+					touched.push_back(c);
+				sum[c] += w->sumTarget[p][c];
+				n[c] += w->visits[p][c];
+				w->sumTarget[p][c] = 0.0;
+				w->visits[p][c] = 0;
+				}
+			w->touched[p].clear();
+			}
+
+		for (int c : touched)
+			{
+			double &v = tables[p]->v[c];
+			v += (1.0 - pow(1.0 - alpha, n[c])) * (sum[c] / n[c] - v);
+			sum[c] = 0.0;
+			n[c] = 0;
+			}
+		}
+	}
+
+// Play totalGames games in epochs of epochGames, on numThreads workers.
+// Returns the games per second;  the game results are added to wins1, wins_1, draws.
+double selfPlay(VTable &V1, VTable &V2, int numThreads, int totalGames, int epochGames,
+				unsigned seed, int &wins1, int &wins_1, int &draws)
+	{
+	vector<Worker *> workers;
+	for (int t = 0; t < numThreads; ++t)
+		{
+		Worker *w = new Worker();			// zero-initialized
+		w->rng.seed(seed + t);
+		workers.push_back(w);
+		}
+
+	auto start = chrono::steady_clock::now();
+	for (int played = 0; played < totalGames; played += epochGames)
+		{
+		int games = min(epochGames, totalGames - played);
+		vector<thread> threads;
+		for (int t = 0; t < numThreads; ++t)
+			{
+			// split the games of the epoch as evenly as possible
+			int share = games / numThreads + (t < games % numThreads ? 1 : 0);
+			if (t == numThreads - 1)
+				workerGames(workers[t], share, &V1, &V2);	// the calling thread works too
+			else
+				threads.push_back(thread(workerGames, workers[t], share, &V1, &V2));
+			}
+		for (thread &th : threads)
+			th.join();
+
+		mergeUpdates(workers, V1, V2);
+		}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	for (Worker *w : workers)
+		{
+		wins1 += w->wins1;
+		wins_1 += w->wins_1;
+		draws += w->draws;
+		delete w;
+		}
+	return totalGames / seconds;
+	}
+
+// **** Scaling test:  the same self-play learner with 1 to N threads.
+// Every run starts from the values in ttt1 / ttt2.  The reference run has 1 thread and
+// epochs of 1 game, ie, the tables are updated after every game like the serial learner.
+// The other runs should give about the same results (win / draw rates), faster.
+extern "C" void self_play_benchmark()
+	{
+	std::list<State> states1, states2;
+	static VTable V1_init, V2_init, V1, V2;
+
+	cout << "Loading values of players 1 and -1...\n";
+	int totalStates1 = loadValues("ttt1", states1, V1_init);
+	int totalStates2 = loadValues("ttt2", states2, V2_init);
+	cout << "Total read: " << to_string(totalStates1) << ", " << to_string(totalStates2) << "\n";
+
+	#define BenchGames		200000
+	#define EpochGames		1000
+	int maxThreads = thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	// 0 = the reference run, then 1, 2, 4, ... threads up to maxThreads
+	vector<int> runs = {0};
+	for (int t = 1; t < maxThreads; t *= 2)
+		runs.push_back(t);
+	runs.push_back(maxThreads);
+
+	printf("\n threads  epoch   games/sec  speedup   wins(1)  wins(-1)   draws\n");
+	double base = 0.0;
+	for (int numThreads : runs)
+		{
+		int threads = (numThreads == 0) ? 1 : numThreads;
+		int epoch = (numThreads == 0) ? 1 : EpochGames;
+
+		V1 = V1_init;
+		V2 = V2_init;
+		int wins1 = 0, wins_1 = 0, draws = 0;
+		double rate = selfPlay(V1, V2, threads, BenchGames, epoch, 12345, wins1, wins_1, draws);
+		if (numThreads == 1)
+			base = rate;
+
+		printf("%8d %6d %11.0f %8.2f %8.1f%% %8.1f%% %6.1f%%\n", threads, epoch, rate,
+			(base > 0.0) ? rate / base : 0.0,
+			wins1 * 100.0 / BenchGames, wins_1 * 100.0 / BenchGames, draws * 100.0 / BenchGames);
+		}
+
+	// The learned tables of the last run, against optimal play
+	scoreMover("V1 after self-play (greedyMove)", 1, []() { return greedyMove(V1, 1); });
+	scoreMover("V2 after self-play (greedyMove)", -1, []() { return greedyMove(V2, -1); });
+	beep();
+	}
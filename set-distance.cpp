@@ -1,16 +1,23 @@
 #include <iostream>
 #include <cstdio>
-#include <random>
-#include <algorithm>		// random_shuffle
+#include <vector>
+#include <cfloat>			// DBL_MAX
+#include <climits>			// LONG_MAX
+#include <cstdint>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <utility>			// swap
+#include "set-distance.h"
 
 using namespace std;
 
 int N = 3;
 
-double random01()
-	{
-	return rand() * 2.0 / (float) RAND_MAX - 1.0;
-	}
+#define Batch	256			// points per batch of the tests;  a batch gives Batch² pairs
 
 // In the current interpretation, each point is a set
 // We want to measure the distance between 2 points as sets and also as lists
@@ -41,59 +48,29 @@ double distance_abs(double x[], double y[])
 // 1) The distance should be 0 under permutations
 // 2) The distance attains its maximum when 2 points are most dissimilar, and would equal the
 //		Euclidean distance between them.
+// It was defined with 3 sums over all pairs:
+//		(2 √(Σ_ij (x_i - y_j)² / N) - √(Σ_ij (x_i - x_j)² / N) - √(Σ_ij (y_i - y_j)² / N)) / 2
+// which set-distance.h computes from Σx, Σx², Σy, Σy², in O(N).
 double set_distance(double x[], double y[])
 	{
-	double sum, sum1, sum2 = 0.0;
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum += pow(x[i] - y[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum1 += pow(x[i] - x[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum2 += pow(y[i] - y[j], 2);
-
-	return (2 * sqrt(sum / N) - sqrt(sum1 / N) - sqrt(sum2 / N)) / 2;
+	return set_distance_moments(N, set_moments(N, x), set_moments(N, y));
 	}
 
 // This is an alternative formula for the set distance, similar to the above,
-// but with a quadratic form that seems to be nicer
+// but with a quadratic form that seems to be nicer:
+//		√((2 Σ_ij (x_i - y_j)² - Σ_ij (x_i - x_j)² - Σ_ij (y_i - y_j)²) / 2N)
 // Update: This formula is bad because the distance between (½, ½) and (1, 0) would be 0.
+// (In terms of the moments it is |Σx - Σy| / √N.)
 double set_distance1(double x[], double y[])
 	{
-	double sum, sum1, sum2 = 0.0;
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum += pow(x[i] - y[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum1 += pow(x[i] - x[j], 2);
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum2 += pow(y[i] - y[j], 2);
-
-	return sqrt((2 * sum / N - sum1 / N - sum2 / N)/ 2);
+	return set_distance1_moments(N, set_moments(N, x), set_moments(N, y));
 	}
 
 // This seems to be an altenative form that failed:
+//		√(Σ_ij (2 (x_i - y_j)² - (x_i - x_j)² - (y_i - y_j)²) / N)
 double set_distance2(double x[], double y[])
 	{
-	double sum = 0.0;
-
-	for (int i = 0; i < N; ++i)
-		for (int j = 0; j < N; ++j)
-			sum += 2 * pow(x[i] - y[j], 2) \
-				- pow(x[i] - x[j], 2) \
-				- pow(y[i] - y[j], 2);
-
-	return sqrt(sum / N);
+	return set_distance2_moments(N, set_moments(N, x), set_moments(N, y));
 	}
 
 // Another altenative form that failed:
@@ -121,16 +98,234 @@ void print_x(double x[])
 	printf("]");
 	}
 
+// **** Monte Carlo harness for tests 1, 2, 3 and 5
+// The random points are drawn in batches, and batch b has its own random stream, seeded
+// by (seed, b).  So a batch is the same whichever thread draws it, and it can be drawn
+// again on its own:  a counterexample is reported with its seed and batch number, and
+//		set-distance <test #> <N> 1 1 <seed> <batch>
+// replays that batch alone.  The threads take batch numbers from a shared counter, reduce
+// each batch to its max / min / ratio, and merge these into the totals under a lock,
+// printing each new extreme.
+
+#define MaxStats	3
+#define MaxReports	10			// counterexamples printed;  the others are only counted
+#define MaxPrintN	16			// larger points are not printed, replay the batch instead
+#define Tolerance	1e-9		// relative, for rounding
+
+// splitmix64:  1 add and 1 mix per number, and a new stream is just a new state
+static inline uint64_t mix64(uint64_t z)
+	{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+	}
+
+struct RANDOM_STREAM
+	{
+	uint64_t state;
+
+	RANDOM_STREAM(uint64_t seed, long batch) : state(mix64(seed + mix64(batch + 1))) {}
+
+	// uniform in [-1, 1)
+	double next()
+		{
+		state += 0x9E3779B97F4A7C15ULL;
+		return (mix64(state) >> 11) * 0x1.0p-52 - 1.0;
+		}
+
+	// uniform in 0 ... n-1
+	int below(int n)
+		{
+		state += 0x9E3779B97F4A7C15ULL;
+		return (int) (((mix64(state) >> 32) * (uint64_t) n) >> 32);
+		}
+	};
+
+// 1 statistic of a test, reduced to its max or min
+struct MONITOR
+	{
+	const char *name;
+	bool maximum;
+	bool withPoints;			// print the points with each new extreme
+	};
+
+struct TEST
+	{
+	const char *title;
+	void (*run)(long batch);
+	long samplesPerBatch;
+	int numStats;
+	MONITOR stat[MaxStats];
+	const char *counterexample;	// what a violation means
+	};
+
+// Where an extreme was found:  the batch and the indices of the points in it
+struct EXTREME
+	{
+	double value;
+	long batch;
+	int i, j, k;
+	};
+
+TEST *test;						// the current test
+uint64_t seed;
+int testNum;
+
+struct STATS
+	{
+	long batch;
+	EXTREME stat[MaxStats];
+	EXTREME violation;			// the first one
+	long violations;
+
+	STATS() {}
+	STATS(long b) : batch(b), violations(0)
+		{
+		for (int s = 0; s < test->numStats; ++s)
+			stat[s] = {test->stat[s].maximum ? -DBL_MAX : DBL_MAX, b, -1, -1, -1};
+		}
+
+	void see(int s, double value, int i, int j, int k = -1)
+		{
+		if (test->stat[s].maximum ? value > stat[s].value : value < stat[s].value)
+			stat[s] = {value, batch, i, j, k};
+		}
+
+	void violate(double value, int i, int j, int k = -1)
+		{
+		if (violations++ == 0)
+			violation = {value, batch, i, j, k};
+		}
+	};
+
+static STATS total;
+static mutex totalLock;
+static atomic<long> nextBatch;
+static long lastBatch;
+
+// Merge the statistics of 1 batch into the totals.  print_points prints the points of an
+// extreme, from the batch that is still in the caller's buffers.
+static void merge(const STATS &s, function<void(const EXTREME &)> print_points)
+	{
+	lock_guard<mutex> lock(totalLock);
+	for (int k = 0; k < test->numStats; ++k)
+		{
+		const MONITOR &m = test->stat[k];
+		const EXTREME &e = s.stat[k];
+		if (m.maximum ? e.value <= total.stat[k].value : e.value >= total.stat[k].value)
+			continue;
+		total.stat[k] = e;
+		printf("%s = %f  (batch %ld)", m.name, e.value, e.batch);
+		if (m.withPoints && N <= MaxPrintN)
+			{
+			printf("\t");
+			print_points(e);
+			}
+		printf("\n");
+		}
+
+	if (s.violations == 0)
+		return;
+	if (total.violations == 0 || s.violation.batch < total.violation.batch)
+		total.violation = s.violation;
+	if (total.violations < MaxReports)
+		{
+		const EXTREME &e = s.violation;
+		printf("%s:  %f in batch %ld of seed %llu\n", test->counterexample, e.value, e.batch,
+			(unsigned long long) seed);
+		printf("\treplay with:  set-distance %d %d 1 1 %llu %ld\n", testNum, N,
+			(unsigned long long) seed, e.batch);
+		if (N <= MaxPrintN)
+			{
+			printf("\t");
+			print_points(e);
+			printf("\n");
+			}
+		}
+	total.violations += s.violations;
+	}
+
+static void worker()
+	{
+	for (long b = nextBatch++; b < lastBatch; b = nextBatch++)
+		test->run(b);
+	}
+
+// Run the current test on samples samples (0 = forever), from batch firstBatch on
+void monte_carlo(long samples, int numThreads, long firstBatch)
+	{
+	long batches = (samples + test->samplesPerBatch - 1) / test->samplesPerBatch;
+	lastBatch = (samples > 0 && batches < LONG_MAX - firstBatch) ? firstBatch + batches : LONG_MAX;
+	nextBatch = firstBatch;
+	total = STATS(-1);
+	total.violations = 0;
+
+	printf("%s\n", test->title);
+	printf("N = %d, seed = %llu, %d threads, ", N, (unsigned long long) seed, numThreads);
+	if (samples > 0)
+		printf("batches %ld - %ld (%ld samples)\n", firstBatch, lastBatch - 1,
+			(lastBatch - firstBatch) * test->samplesPerBatch);
+	else
+		printf("no sample limit\n");
+
+	auto start = chrono::steady_clock::now();
+	vector<thread> threads;
+	for (int t = 1; t < numThreads; ++t)
+		threads.push_back(thread(worker));
+	worker();							// the calling thread works too
+	for (thread &th : threads)
+		th.join();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	long done = (lastBatch - firstBatch) * test->samplesPerBatch;
+	printf("\n%ld samples in %.2f s  (%.3g samples/s)\n", done, seconds, done / seconds);
+	for (int k = 0; k < test->numStats; ++k)
+		printf("%s = %f  (batch %ld)\n", test->stat[k].name, total.stat[k].value, total.stat[k].batch);
+	printf("%ld counterexamples (%s)", total.violations, test->counterexample);
+	if (total.violations > 0)
+		printf(", the first in batch %ld", total.violation.batch);
+	printf("\n");
+	}
+
+void test_1(long batch), test_2(long batch), test_3(long batch), test_5(long batch);
+
+TEST tests[] =
+	{
+	{"Test that the maximal Euclidean distance between 2 points in the unit hypercube is √n",
+		test_1, (long) Batch * Batch,
+		1, {{"max d2", true, false}},
+		"d2 > 2√N"},
+	{"Randomly permute (x, ..., xn) and check if the set distances between the original\n"
+		"and permuted sets (points) are 0.",
+		test_2, Batch,
+		2, {{"max distance", true, false}, {"min distance", false, false}},
+		"distance ≠ 0"},
+	{"Test that the set distance is always less than or equal to the Euclidean distance\n"
+		"This ratio approaches the maximum value of 1 as more and more pairs are tested",
+		test_3, (long) Batch * Batch,
+		3, {{"max d1", true, false}, {"min d1", false, false}, {"d1:d2", true, true}},
+		"d1 > d2"},
+	{"Test triangle inequality",
+		test_5, (long) Batch * (Batch - 1) * (Batch - 1),
+		1, {{"d(x,y) - d(x,z) - d(z,y)", true, true}},
+		"Triangle inequality violated"},
+	};
+
 int main(int argc, char **argv)
 	{
-	void test_1(), test_2(), test_3(), test_4(), test_5();
-	int test_num;
+	void test_4();
+	long samples = 0, firstBatch = 0;
+	int numThreads = thread::hardware_concurrency();
 
-	if (argc != 3)
+	if (argc < 3 || argc > 7)
 		{
-		printf("usage: set_distance <test #> <N>\n");
-		printf("where <test #> = 1, 2, 3 or 4\n");
+		printf("usage: set_distance <test #> <N> [<samples> [<threads> [<seed> [<first batch>]]]]\n");
+		printf("where <test #> = 1, 2, 3, 4 or 5\n");
 		printf("      <N> = dimension of set vectors\n");
+		printf("      <samples> = pairs (or points, or triples) to test, 0 = forever (default)\n");
+		printf("      <threads> = default 1 per core\n");
+		printf("      <seed> = default the time;  counterexamples are reported with it\n");
+		printf("      <first batch> = to replay the batch of a counterexample\n");
 		printf("1. Test that the maximal Euclidean distance between 2 points in the unit hypercube is √n\n");
 		printf("2. Randomly permute (x, ..., xn) and check if the set distances between the original\n");
 		printf("\tand permuted sets (points) are 0.\n");
@@ -140,148 +335,110 @@ int main(int argc, char **argv)
 		printf("5. Test triangle inequality\n");
 		exit(0);
 		}
-	else
-		{
-		test_num = std::stoi(argv[1]);
-		N = std::stoi(argv[2]);
-		}
 
-	srand(time(NULL));				// random seed
-
-	switch (test_num)
+	testNum = std::stoi(argv[1]);
+	N = std::stoi(argv[2]);
+	seed = time(NULL);
+	if (argc > 3)
+		samples = std::stol(argv[3]);
+	if (argc > 4)
+		numThreads = std::stoi(argv[4]);
+	if (argc > 5)
+		seed = std::stoull(argv[5]);
+	if (argc > 6)
+		firstBatch = std::stol(argv[6]);
+	if (numThreads < 1)
+		numThreads = 1;
+
+	switch (testNum)
 		{
 		case 1:
-			test_1();
-			break;
 		case 2:
-			test_2();
-			break;
 		case 3:
-			test_3();
+			test = &tests[testNum - 1];
+			monte_carlo(samples, numThreads, firstBatch);
 			break;
 		case 4:
 			test_4();
 			break;
 		case 5:
-			test_5();
+			test = &tests[3];
+			monte_carlo(samples, numThreads, firstBatch);
 			break;
 		}
 	}
 
-void test_3()
+// Set distance ≤ Euclidean distance, for Batch × Batch pairs
+void test_3(long batch)
 	{
-	printf("Test that the set distance is always less than or equal to the Euclidean distance\n");
-	printf("This ratio approaches the maximum value of 1 as more and more pairs are tested\n");
-
-	double x[N], y[N], d1, d2, r;
-	double max_d1, min_d1, max_r = 0.0;
-	bool remarkable;
+	thread_local vector<double> X, Y, D1, D2;
+	X.resize(Batch * N), Y.resize(Batch * N);
+	D1.resize(Batch * Batch), D2.resize(Batch * Batch);
 
-	// Generate and test random pairs of points
-	while (true)
+	RANDOM_STREAM random(seed, batch);
+	for (int j = 0; j < Batch * N; ++j)
 		{
-		for (int j = 0; j < N; ++j)
-			{
-			x[j] = random01();
-			y[j] = random01();
-			}
-
-		d1 = set_distance(x, y);
-		d2 = distance_Eu(x, y);
-		r = d1 / d2;
-
-		remarkable = false;
+		X[j] = random.next();
+		Y[j] = random.next();
+		}
+	set_distance_matrix(SetDistance, N, Batch, X.data(), Batch, Y.data(), D1.data());
+	distance_Eu_matrix(N, Batch, X.data(), Batch, Y.data(), D2.data());
 
-		if (d1 > max_d1)
+	STATS s(batch);
+	for (int p = 0; p < Batch; ++p)
+		for (int q = 0; q < Batch; ++q)
 			{
-			// remarkable = true;
-			printf("max d1 = %f\n", max_d1);
-			max_d1 = d1;
+			double d1 = D1[p * Batch + q];
+			double d2 = D2[p * Batch + q];
+			double r = d1 / d2;
+
+			s.see(0, d1, p, q);
+			s.see(1, d1, p, q);
+			s.see(2, r, p, q);
+			if (r > 1.0 + Tolerance)
+				s.violate(r, p, q);
 			}
-		if (d1 < min_d1)
-			{
-			// remarkable = true;
-			printf("min d1 = %f\n", min_d1);
-			min_d1 = d1;
-			}
-		if (r > max_r)
-			{
-			max_r = r;
-			printf("d1:d2 = %f\t", max_r);
-			print_x(x); printf("\t");
-			print_x(y); printf("\n");
-			}
-
-		// if (d1 > 0.6)
-		//	remarkable = true;
-		// if (d1 > d2)
-		//	remarkable = true;
-		// if (d2 > 0.99)
-		//	remarkable = true;
-		// if (d1_d2 > 0.99999)
-		//	remarkable = true;
 
-		if (remarkable)
-			{
-			printf("\nd1=%f%c\t", d1, d1 > 1.0 ? 'x' : ' ');
-			printf("d2=%f\t", d2);
-			printf("d1:d2=%f%c\n", r, d2 > d1 ? '+' : ' ');
-			}
-		// else
-		//	printf(".");
-		}
+	merge(s, [&](const EXTREME &e)
+		{
+		print_x(&X[e.i * N]); printf("\t");
+		print_x(&Y[e.j * N]);
+		});
 	}
 
-void test_2()
+// Each point of the batch against a random permutation of itself
+void test_2(long batch)
 	{
-	printf("Randomly permute (x, ..., xn) and check if the set distances between the original\n");
-	printf("and permuted sets (points) are 0.\n");
+	thread_local vector<double> X, Y;
+	X.resize(Batch * N), Y.resize(Batch * N);
 
-	double x[N], y[N], d;
-	double max_d, min_d = 0.0;
-
-	// Generate a point and duplicate it
-	while (true)
+	RANDOM_STREAM random(seed, batch);
+	for (int j = 0; j < Batch * N; ++j)
+		Y[j] = X[j] = random.next();
+	for (int p = 0; p < Batch; ++p)
 		{
-		/*
-		cout << "x=? ";
-		for (int j = 0; j < N; ++j)
-			cin >> x[j];
-
-		cout << "y=? ";
-		for (int j = 0; j < N; ++j)
-			cin >> y[j];
-
-		print_x(x);  printf("\t");
-		print_x(y);  printf("\n");
-
-		d = set_distance(x, y);
-		printf("distance = %f\n", d);
-		continue;
-		*/
-
-		for (int j = 0; j < N; ++j)
-			{
-			x[j] = random01();
-			y[j] = x[j];
-			}
-		std::random_shuffle(y, y + N);
-		// print_x(x);  printf("\t");
-		// print_x(y);  printf("\n");
+		double *y = &Y[p * N];
+		for (int i = N - 1; i > 0; --i)
+			swap(y[i], y[random.below(i + 1)]);
+		}
 
-		d = set_distance(x, y);
+	STATS s(batch);
+	for (int p = 0; p < Batch; ++p)
+		{
+		double d = set_distance_moments(N, set_moments(N, &X[p * N]), set_moments(N, &Y[p * N]));
 
-		if (d > max_d)
-			{
-			max_d = d;
-			printf("max distance = %f\n", max_d);
-			}
-		if (d < min_d)
-			{
-			min_d = d;
-			printf("min distance = %f\n", min_d);
-			}
+		s.see(0, d, p, p);
+		s.see(1, d, p, p);
+		// the moments are sums in a different order, so they can differ by rounding
+		if (fabs(d) > Tolerance * sqrt(N))
+			s.violate(d, p, p);
 		}
+
+	merge(s, [&](const EXTREME &e)
+		{
+		print_x(&X[e.i * N]); printf("\t");
+		print_x(&Y[e.j * N]);
+		});
 	}
 
 void test_4()
@@ -312,58 +469,67 @@ void test_4()
 	}
 
 // Triangle inequality: d(x,y) ≤ d(x,z) + d(z,y)
-void test_5()
+// All the triples of a batch are tested, with 1 distance matrix.
+// (Triples with z = x or z = y only test rounding, because d(x,x) = 0.)
+void test_5(long batch)
 	{
-	printf("Test triangle inequality\n");
-
-	double x[N], y[N], z[N], dxy, dxz, dzy, diff;
-
-	while (true)
+	thread_local vector<double> X, D;
+	X.resize(Batch * N), D.resize(Batch * Batch);
+
+	RANDOM_STREAM random(seed, batch);
+	for (int j = 0; j < Batch * N; ++j)
+		X[j] = random.next();
+	set_distance_matrix(SetDistance, N, Batch, X.data(), Batch, X.data(), D.data());
+
+	STATS s(batch);
+	for (int x = 0; x < Batch; ++x)
+		for (int y = 0; y < Batch; ++y)
+			for (int z = 0; z < Batch; ++z)
+				{
+				if (z == x || z == y)
+					continue;
+				double diff = D[x * Batch + y] - D[x * Batch + z] - D[z * Batch + y];
+				s.see(0, diff, x, y, z);
+				if (diff > Tolerance * D[x * Batch + y])
+					s.violate(diff, x, y, z);
+				}
+
+	merge(s, [&](const EXTREME &e)
 		{
-		for (int j = 0; j < N; ++j)
-			{
-			x[j] = random01();
-			y[j] = random01();
-			z[j] = random01();
-			}
-		
-		dxy = set_distance(x, y);
-		dxz = set_distance(x, z);
-		dzy = set_distance(z, y);
-		diff = dxy - dxz - dzy;
-
-		print_x(x); printf("\t");
-		print_x(y); printf("\t");
-		print_x(z); printf("\n");
-		printf("d(x,y) - d(x,z) - d(z,y) = %f\n", diff);
-
-		if (diff > 0.0)
-			{
-			printf("Triangle inequality violated\n");
-			break;
-			}
-		}
+		print_x(&X[e.i * N]); printf("\t");
+		print_x(&X[e.j * N]); printf("\t");
+		print_x(&X[e.k * N]);
+		});
 	}
 
-void test_1()
+// The largest Euclidean distance between points of [-1, 1]^N is 2√N
+void test_1(long batch)
 	{
-	printf("Test that the maximal Euclidean distance between 2 points in the unit hypercube is √n\n");
-
-	double x[N], y[N], d2;
-	double max_d2 = 0.0;
+	thread_local vector<double> X, Y, D2;
+	X.resize(Batch * N), Y.resize(Batch * N), D2.resize(Batch * Batch);
 
-	while (true)
+	RANDOM_STREAM random(seed, batch);
+	for (int j = 0; j < Batch * N; ++j)
 		{
-		for (int j = 0; j < N; ++j)
-			{
-			x[j] = random01();
-			y[j] = random01();
-			}
-		d2 = distance_Eu(x, y);
-		if (d2 > max_d2)
+		X[j] = random.next();
+		Y[j] = random.next();
+		}
+	distance_Eu_matrix(N, Batch, X.data(), Batch, Y.data(), D2.data());
+
+	STATS s(batch);
+	double limit = 2.0 * sqrt(N) * (1.0 + Tolerance);
+	for (int p = 0; p < Batch; ++p)
+		for (int q = 0; q < Batch; ++q)
 			{
-			max_d2 = d2;
-			printf("max d2 = %f\n", max_d2);	
+			double d2 = D2[p * Batch + q];
+			s.see(0, d2, p, q);
+			if (d2 > limit)
+				s.violate(d2, p, q);
 			}
-		}
+
+	merge(s, [&](const EXTREME &e)
+		{
+		print_x(&X[e.i * N]); printf("\t");
+		print_x(&Y[e.j * N]);
+		});
 	}
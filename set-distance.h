@@ -0,0 +1,134 @@
+// Set-distance kernels, computed from the moments of the points.
+
+// A point x = (x1, ..., xn) is seen as a set of n numbers.  The set distances compare all
+// the pairs of elements, but the sums over pairs collapse to the moments S = Σ x_i and
+// Q = Σ x_i²:
+//		(1/n) Σ_ij (x_i - y_j)² = Qx + Qy - 2 Sx Sy / n
+//		(1/n) Σ_ij (x_i - x_j)² = 2 (Qx - Sx² / n)
+// So a distance takes O(n) instead of O(n²), and for P × Q pairs, the moments of the
+// P + Q points are computed once and every pair takes O(1).
+// (Rounding can make the 2nd sum slightly negative when all x_i are equal, so it is
+// clamped to 0.)
+
+#ifndef SET_DISTANCE_H
+#define SET_DISTANCE_H
+
+#include <cmath>
+#include <vector>
+
+typedef struct SET_MOMENTS
+	{
+	double S;					// Σ x_i
+	double Q;					// Σ x_i²
+	} SET_MOMENTS;
+
+static inline SET_MOMENTS set_moments(int n, const double x[])
+	{
+	double S = 0.0, Q = 0.0;
+	#pragma omp simd reduction(+:S,Q)
+	for (int i = 0; i < n; ++i)
+		{
+		S += x[i];
+		Q += x[i] * x[i];
+		}
+	return {S, Q};
+	}
+
+// (1/n) Σ_ij (x_i - y_j)²
+static inline double cross_moment(int n, SET_MOMENTS x, SET_MOMENTS y)
+	{
+	double sum = x.Q + y.Q - 2.0 * x.S * y.S / n;
+	return sum > 0.0 ? sum : 0.0;
+	}
+
+// (1/n) Σ_ij (x_i - x_j)²
+static inline double self_moment(int n, SET_MOMENTS x)
+	{
+	double sum = 2.0 * (x.Q - x.S * x.S / n);
+	return sum > 0.0 ? sum : 0.0;
+	}
+
+// The 3 set distances of set-distance.cpp, from the moments
+static inline double set_distance_moments(int n, SET_MOMENTS x, SET_MOMENTS y)
+	{
+	return (2.0 * sqrt(cross_moment(n, x, y)) - sqrt(self_moment(n, x)) - sqrt(self_moment(n, y))) / 2.0;
+	}
+
+// The other 2 collapse further:  the Q terms cancel, leaving (Sx - Sy)² / n under the root.
+// So they are computed directly, instead of as a difference of nearly equal moments, whose
+// rounding noise would be square-rooted.
+// = |Sx - Sy| / √n, which is why (½, ½) and (1, 0) are at distance 0
+static inline double set_distance1_moments(int n, SET_MOMENTS x, SET_MOMENTS y)
+	{
+	return fabs(x.S - y.S) / sqrt(n);
+	}
+
+// = √2 |Sx - Sy| / √n
+static inline double set_distance2_moments(int n, SET_MOMENTS x, SET_MOMENTS y)
+	{
+	return fabs(x.S - y.S) * sqrt(2.0 / n);
+	}
+
+// **** Batched API:  D[p * Q + q] = distance between X[p] and Y[q], for P × Q pairs.
+// X and Y hold their points one after another, n numbers per point.
+enum { SetDistance, SetDistance1, SetDistance2 };
+
+static inline void set_distance_matrix(int kind, int n, int P, const double X[], int Q, const double Y[],
+										double D[])
+	{
+	std::vector<SET_MOMENTS> mX(P), mY(Q);
+	std::vector<double> rootY(Q);
+	for (int p = 0; p < P; ++p)
+		mX[p] = set_moments(n, X + (size_t) p * n);
+	for (int q = 0; q < Q; ++q)
+		{
+		mY[q] = set_moments(n, Y + (size_t) q * n);
+		rootY[q] = sqrt(self_moment(n, mY[q]));
+		}
+
+	for (int p = 0; p < P; ++p)
+		{
+		SET_MOMENTS x = mX[p];
+		double rootX = sqrt(self_moment(n, x));
+		double *row = D + (size_t) p * Q;
+		const SET_MOMENTS *y = mY.data();
+		const double *rY = rootY.data();
+		switch (kind)
+			{
+			case SetDistance:
+				#pragma omp simd
+				for (int q = 0; q < Q; ++q)
+					row[q] = (2.0 * sqrt(cross_moment(n, x, y[q])) - rootX - rY[q]) / 2.0;
+				break;
+			case SetDistance1:
+			case SetDistance2:
+				{
+				double scale = (kind == SetDistance1) ? 1.0 / sqrt(n) : sqrt(2.0 / n);
+				#pragma omp simd
+				for (int q = 0; q < Q; ++q)
+					row[q] = fabs(x.S - y[q].S) * scale;
+				break;
+				}
+			}
+		}
+	}
+
+// Euclidean distances of the P × Q pairs, as lists:  ‖x - y‖
+static inline void distance_Eu_matrix(int n, int P, const double X[], int Q, const double Y[], double D[])
+	{
+	for (int p = 0; p < P; ++p)
+		{
+		const double *x = X + (size_t) p * n;
+		for (int q = 0; q < Q; ++q)
+			{
+			const double *y = Y + (size_t) q * n;
+			double sum = 0.0;
+			#pragma omp simd reduction(+:sum)
+			for (int i = 0; i < n; ++i)
+				sum += (x[i] - y[i]) * (x[i] - y[i]);
+			D[(size_t) p * Q + q] = sqrt(sum);
+			}
+		}
+	}
+
+#endif
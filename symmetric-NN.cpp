@@ -4,11 +4,21 @@
 
 // The entire network is composed of a g-network and an h-network.
 // The g-layers form a regular NN.
-// The h-layers form another NN but it is averaged over m inputs, where m is the multiplicity
+// The h-layers form another NN, whose weights are shared by all the m inputs (m is the
+// multiplicity):  there is only 1 h-network, applied to the m inputs as a batch, and its
+// outputs are pooled (added up, averaged, or max'ed) to form the input of the g-network.
+// In back-prop, every input gets its share of the error ∂E/∂Y, and the weight changes of
+// the m rows are added up.
+
+// The sets need not have the same size:  the set encoder below takes a "ragged" batch of
+// sets of any sizes, and trains them together in 1 batched pass through h and 1 through g.
 
 #include <iostream>
 #include <cstdio>
 #include <cmath>
+#include <cstdlib>
+#include <cassert>
+#include <chrono>
 #include <algorithm>
 #include <random>
 #include "feedforward-NN.h"
@@ -22,6 +32,14 @@ extern void forward_prop_ReLU(NNET *, int, double *);
 extern void forward_prop_softplus(NNET *, int, double *);
 extern void forward_prop_x2(NNET *, int, double *);
 extern void back_prop(NNET *, double *);
+extern void back_prop_input(NNET *, double *, double *);
+extern void update_weights(NNET *);
+extern BATCH *create_batch(NNET *, int);
+extern void free_batch(BATCH *);
+extern void forward_prop_sigmoid_batch(NNET *, BATCH *, int, int, double *);
+extern void back_prop_batch(NNET *, BATCH *, int, double *);
+extern void back_prop_input_batch(NNET *, BATCH *, int, double *, double *);
+extern void update_weights_batch(NNET *, BATCH *, int);
 extern void back_prop_ReLU(NNET *, double *);
 extern void re_randomize(NNET *, int, int *);
 extern double sigmoid(double);
@@ -50,47 +68,192 @@ extern void plot_ideal(void);
 // extern "C" void beep(void);
 // extern "C" void start_timer(), end_timer(char *); 
 
-// The input vector is of dimension N × M, where
-// M = number of input elements, which I also call 'multiplicity':
-#define M		3
+// Each input element is a vector of dimension N.  The sets of a batch have from
+// MinSetSize to MaxSetSize elements, which I also call 'multiplicity':
+#define MinSetSize	1
+#define MaxSetSize	6
+#define SetBatch	16			// sets per training step
 // N = dimension of the embedding / encoding of each input element:
 #define N		2
 
-double X[M][N];
-double Y[N];
+double X[SetBatch * MaxSetSize][N];		// the elements of all the sets, set after set
+int offsets[SetBatch + 1];				// set s = rows offsets[s] ... offsets[s+1]-1 of X
 
 double random01()		// create random number in standard interval, eg. [-1,1]
 	{
 	return rand() * 2.0 / (float) RAND_MAX - 1.0;
 	}
 
+// ***** Set encoder:  f(set) = g(pool { h(x) : x ∊ set }), for ragged batches of sets.
+// A batch of numSets sets is 1 flat matrix of elements, 1 row of dim_X per element, and
+// offsets[0 ... numSets]:  the elements of set s are the rows offsets[s] ... offsets[s+1]-1,
+// so set s has offsets[s+1] - offsets[s] elements (possibly 0).  h is run on all the
+// elements of the batch in 1 pass, the rows of each set are pooled into 1 row (segmented
+// sum, mean or max), and g is run on the pooled rows, again in 1 pass.
+enum { PoolSum, PoolMean, PoolMax };
+
+typedef struct SET_ENCODER
+	{
+	NNET *h, *g;
+	BATCH *batch_h;				// 1 row per element
+	BATCH *batch_g;				// 1 row per set
+	int maxElements, maxSets;
+	int pooling;
+	int dim_X, dim_Y, dim_out;	// of an element, of a pooled row (= h's output), of g's output
+	double *pooled;				// numSets × dim_Y, the input of g
+	int *argmax;				// numSets × dim_Y, for PoolMax:  row of the max, -1 = empty set
+	double *error_Y;			// numSets × dim_Y
+	double *error_h;			// numElements × dim_Y
+	double *errors;				// numSets × dim_out
+	} SET_ENCODER;
+
+SET_ENCODER *create_set_encoder(int numLayers_h, int *neuronsPerLayer_h,
+								int numLayers_g, int *neuronsPerLayer_g,
+								int maxElements, int maxSets, int pooling)
+	{
+	SET_ENCODER *enc = (SET_ENCODER *) malloc(sizeof (SET_ENCODER));
+	enc->h = create_NN(numLayers_h, neuronsPerLayer_h);
+	enc->g = create_NN(numLayers_g, neuronsPerLayer_g);
+	enc->batch_h = create_batch(enc->h, maxElements);
+	enc->batch_g = create_batch(enc->g, maxSets);
+	enc->maxElements = maxElements;
+	enc->maxSets = maxSets;
+	enc->pooling = pooling;
+	enc->dim_X = neuronsPerLayer_h[0];
+	enc->dim_Y = neuronsPerLayer_h[numLayers_h - 1];
+	enc->dim_out = neuronsPerLayer_g[numLayers_g - 1];
+	assert(neuronsPerLayer_g[0] == enc->dim_Y);
+
+	enc->pooled = (double *) malloc(maxSets * enc->dim_Y * sizeof (double));
+	enc->argmax = (int *) malloc(maxSets * enc->dim_Y * sizeof (int));
+	enc->error_Y = (double *) malloc(maxSets * enc->dim_Y * sizeof (double));
+	enc->error_h = (double *) malloc(maxElements * enc->dim_Y * sizeof (double));
+	enc->errors = (double *) malloc(maxSets * enc->dim_out * sizeof (double));
+	return enc;
+	}
+
+void free_set_encoder(SET_ENCODER *enc, int *neuronsPerLayer_h, int *neuronsPerLayer_g)
+	{
+	free_batch(enc->batch_h);
+	free_batch(enc->batch_g);
+	free_NN(enc->h, neuronsPerLayer_h);
+	free_NN(enc->g, neuronsPerLayer_g);
+	free(enc->pooled);
+	free(enc->argmax);
+	free(enc->error_Y);
+	free(enc->error_h);
+	free(enc->errors);
+	free(enc);
+	}
+
+// Forward-prop a batch of sets.  Returns g's outputs, numSets × dim_out.
+double *encode_sets(SET_ENCODER *enc, int numSets, const int offsets[], double elements[])
+	{
+	int numElements = offsets[numSets];
+	assert(numSets <= enc->maxSets && numElements <= enc->maxElements);
+	int dim_Y = enc->dim_Y;
+
+	forward_prop_sigmoid_batch(enc->h, enc->batch_h, numElements, enc->dim_X, elements);
+	double *out_h = enc->batch_h->outputs[enc->h->numLayers - 1];
+
+	// Bridge layer:  segmented pooling of h's rows, 1 segment per set
+	for (int set = 0; set < numSets; ++set)
+		{
+		int first = offsets[set], last = offsets[set + 1];
+		double *Y = enc->pooled + set * dim_Y;
+		int *arg = enc->argmax + set * dim_Y;
+		for (int i = 0; i < dim_Y; ++i)
+			{
+			Y[i] = 0.0;						// also the value of an empty set
+			arg[i] = -1;
+			}
+
+		for (int r = first; r < last; ++r)
+			{
+			double *row = out_h + r * dim_Y;
+			for (int i = 0; i < dim_Y; ++i)
+				if (enc->pooling != PoolMax)
+					Y[i] += row[i];
+				else if (arg[i] < 0 || row[i] > Y[i])
+					{
+					Y[i] = row[i];
+					arg[i] = r;
+					}
+			}
+
+		if (enc->pooling == PoolMean && last > first)
+			for (int i = 0; i < dim_Y; ++i)
+				Y[i] /= (last - first);
+		}
+
+	forward_prop_sigmoid_batch(enc->g, enc->batch_g, numSets, dim_Y, enc->pooled);
+	return enc->batch_g->outputs[enc->g->numLayers - 1];
+	}
+
+// 1 training step on a batch of sets, with targets = numSets × dim_out.
+// The weight changes of all the sets (in g) and of all the elements (in h) are added up.
+// Returns the mean square error, before the step.
+double train_sets(SET_ENCODER *enc, int numSets, const int offsets[], double elements[],
+				  double targets[])
+	{
+	double *output = encode_sets(enc, numSets, offsets, elements);
+	int dim_Y = enc->dim_Y;
+
+	double sumOfSquareError = 0.0;
+	for (int k = 0; k < numSets * enc->dim_out; ++k)
+		{
+		enc->errors[k] = targets[k] - output[k];	// error = ideal - actual
+		sumOfSquareError += enc->errors[k] * enc->errors[k];
+		}
+
+	// The errors of the pooled rows are taken before g's weights change
+	back_prop_input_batch(enc->g, enc->batch_g, numSets, enc->errors, enc->error_Y);
+	update_weights_batch(enc->g, enc->batch_g, numSets);
+
+	// Bridge layer:  ∂Y/∂h(x) is 1 for sum, 1/size for mean, and 1 for the max element only
+	for (int set = 0; set < numSets; ++set)
+		{
+		int first = offsets[set], last = offsets[set + 1];
+		double *error_Y = enc->error_Y + set * dim_Y;
+		int *arg = enc->argmax + set * dim_Y;
+		double scale = (enc->pooling == PoolMean) ? 1.0 / (last - first) : 1.0;
+		for (int r = first; r < last; ++r)
+			{
+			double *error_h = enc->error_h + r * dim_Y;
+			for (int i = 0; i < dim_Y; ++i)
+				if (enc->pooling == PoolMax)
+					error_h[i] = (arg[i] == r) ? error_Y[i] : 0.0;
+				else
+					error_h[i] = error_Y[i] * scale;
+			}
+		}
+
+	back_prop_batch(enc->h, enc->batch_h, offsets[numSets], enc->error_h);
+	return sumOfSquareError / (numSets * enc->dim_out);
+	}
+
 // ***** To test the NN, we use as target function a sum of N-dimensional Gaussian
 // functions with random centers.  The sum would consists of N such functions.
 // The formula of the target function is:
 //		f(x) = (1/N) ∑ exp-(kr)²
 // where r = ‖ x-c ‖ where c is the center of the Gaussian function
-// (k is the 'narrowness' of the Gaussian, for which 10.0 seems to be a nice value)
-// Also, this function should be invariant under permutations.
+// (k is the 'narrowness' of the Gaussian)
+// For a set, each component of f is averaged over the elements, so that f is invariant
+// under permutations and defined for sets of any size.
 
 // Centers of N Gaussian functions:
-double c[N][M][N];
+double c[N][N];
 
-double target_func(double x[M][N], double y[N])		// dim X = M × N, dim Y = N
+void target_func(int size, double x[][N], double y[N])		// dim x = size × N, dim y = N
 	{
-	// **** Sort input elements
-
-	#define k2 500.0				// k² where k = 10.0
+	#define k2 10.0					// k² where k ≈ 3, a wider Gaussian than in 1 dimension
 	for (int i = 0; i < N; ++i)		// calculate each component of y
 		{
 		y[i] = 0.0;
 		for (int n = 0; n < N; ++n)		// for each Gaussian function; there are N of them
-			{
-			double r2 = 0.0;			// r² = ‖ x-c ‖²
-			for (int m = 0; m < M; ++m)
-				r2 += pow(x[m][i] - c[n][m][i], 2);
-			y[i] += exp(- k2 * r2);		// add one Gaussian to y[i]
-			}
-		y[i] /= N;
+			for (int m = 0; m < size; ++m)
+				y[i] += exp(- k2 * pow(x[m][i] - c[n][i], 2));	// add one Gaussian to y[i]
+		y[i] /= N * (size > 0 ? size : 1);
 		}
 	}
 
@@ -99,7 +262,6 @@ double target_func(double x[M][N], double y[N])		// dim X = M × N, dim Y = N
 
 // Success: time 5:58, topology = {2, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 1} (13 layers)
 //			ReLU units, learning rate 0.05, leakage 0.0
-#define ForwardPropMethod	forward_prop_sigmoid
 #define ErrorThreshold		0.02
 
 int main(int argc, char **argv)
@@ -107,16 +269,17 @@ int main(int argc, char **argv)
 	int neuronsPerLayer[] = {N, 10, 10, 8, N}; // first = input layer, last = output layer
 	int numLayers = sizeof (neuronsPerLayer) / sizeof (int);
 
-	NNET *Net_g = create_NN(numLayers, neuronsPerLayer);
-	LAYER lastLayer_g = Net_g->layers[numLayers - 1];
+	// Pooling of the h outputs:  sum, mean (the default) or max
+	int pooling = PoolMean;
+	if (argc > 1 && string(argv[1]) == "sum")
+		pooling = PoolSum;
+	if (argc > 1 && string(argv[1]) == "max")
+		pooling = PoolMax;
 
-	NNET *Net_h[M];
-	LAYER lastLayer_h[M];
-	for (int m = 0; m < M; ++m)
-		{
-		Net_h[m] = create_NN(numLayers, neuronsPerLayer);
-		lastLayer_h[m] = Net_h[m]->layers[numLayers - 1];
-		}
+	// 1 h-network for all the elements of all the sets, 1 g-network for all the sets
+	SET_ENCODER *enc = create_set_encoder(numLayers, neuronsPerLayer, numLayers, neuronsPerLayer,
+										  SetBatch * MaxSetSize, SetBatch, pooling);
+	double ideal[SetBatch][N];
 
 	int userKey = 0;
 	#define num_errs	50			// how many errors to record for averaging
@@ -171,20 +334,13 @@ int main(int argc, char **argv)
 	// fclose(pFile);
 
 	// ***** First we generate the random centers of N Gaussian functions
-	// Note that these centers are 'sorted' such that the resulting points all reside in the
-	// 'symmetric' region.
 	for (int n = 0; n < N; ++n)
-		for (int m = 0; m < M; ++m)
-			{
-			for (int i = 0; i < N; ++i)
-				c[n][m][i] = random01();
-			sort(c[n][m], c[n][m] + N);
-			}
-
-	for (int m = 0; m < M; ++m)
 		{
 		for (int i = 0; i < N; ++i)
-			printf("%f ", c[0][m][i]);
+			{
+			c[n][i] = random01();
+			printf("%f ", c[n][i]);
+			}
 		printf("\n");
 		}
 
@@ -201,106 +357,31 @@ int main(int argc, char **argv)
 	// start_timer();
 
 	char status[1024], *s;
+	#define ReportSteps	1000		// training steps between status lines
+	double sum_report = 0.0;
+	auto start = chrono::steady_clock::now();
 
 	for (int l = 1; true; ++l)			// main loop
 		{
 		s = status + sprintf(status, "[%05d] ", l);
 
-		// ***** Create M random X vectors (each of dim N)
-		for (int m = 0; m < M; ++m)
-			for (int i = 0; i < N; ++i)
-				// X[k] = (rand() / (float) RAND_MAX);
-				X[m][i] = random01();
-
-		// ***** Forward propagation
-
-		for (int m = 0; m < M; ++m)
-			ForwardPropMethod(Net_h[m], N, X[m]);			// X[m] is updated
-
-		// Bridge layer: add up X[m] to get Y
-		for (int i = 0; i < N; ++i)
-			{
-			Y[i] = 0;
-			for (int m = 0; m < M; ++m)
-				{
-				Y[i] += X[m][i];
-				}
-			}
-
-		ForwardPropMethod(Net_g, N, Y);					// Y is updated
-
-		// ***** Calculate target value
-
-		double training_err = 0.0;
-		double ideal[N];
-		target_func(X, ideal);
-
-		// ***** Calculate the error
-
-		double error[N];
-		for (int i = 0; i < N; ++i)
-			error[i] = ideal[i] - lastLayer_g.neurons[i].output;
-
-		// training_err += fabs(error); // record sum of errors
-		// printf("sum of squared error = %lf  ", training_err);
-
-		// update error arrays cyclically
-		// (This is easier to understand by referring to the next block of code)
-		// sum_err2 -= errors2[tail];
-		// sum_err2 += errors1[tail];
-		// sum_err1 -= errors1[tail];
-		// sum_err1 += training_err;
-		// printf("sum1, sum2 = %lf %lf\n", sum_err1, sum_err2);
-
-		double mean_err = 0.0;
-		for (int i = 0; i < N; ++i)
-			mean_err += pow(error[i], 2);
-		mean_err /= N;
-		// double mean_err = (l < num_errs) ? (sum_err1 / l) : (sum_err1 / num_errs);
-		// if (mean_err < 2.0)
-		//	s += sprintf(s, "mean |e|=%1.06lf, ", mean_err);
-		// else
-		//	s += sprintf(s, "mean |e|=%e, ", mean_err);
-
-		// record new error in cyclic arrays
-		// errors2[tail] = errors1[tail];
-		// errors1[tail] = training_err;
-		// ++tail;
-		// if (tail == num_errs) // loop back in cycle
-		//	tail = 0;
-
-		// ***** Back-propagation
-		back_prop(Net_g, error);
-
-		// ***** Bridge between g_network and h_networks
-		// This emulates the back-prop algorithm for 1 layer (see "g-and-h-networks.png")
-		// and the error is simply copied to each h-network
-		LAYER prevLayer = Net_g->layers[0];
-		for (int n = 0; n < N; n++)		// for error in bridge layer
+		// ***** Create SetBatch sets of random sizes, of random X vectors (each of dim N)
+		offsets[0] = 0;
+		for (int set = 0; set < SetBatch; ++set)
 			{
-			// local gradient ≡ 1 for the bridge layer, because there's no sigmoid function
-			error[n] = prevLayer.neurons[n].grad;
+			int size = MinSetSize + rand() % (MaxSetSize - MinSetSize + 1);
+			offsets[set + 1] = offsets[set] + size;
+			for (int m = offsets[set]; m < offsets[set + 1]; ++m)
+				for (int i = 0; i < N; ++i)
+					X[m][i] = random01();
+
+			// ***** Calculate target value
+			target_func(size, X + offsets[set], ideal[set]);
 			}
 
-		// ***** Back-propagate the h-networks
-		for (int m = 0; m < M; m++)
-			back_prop(Net_h[m], error);
-
-		// Updated weights of the h-networks is now averaged:
-		for (int l = 1; l < numLayers; ++l)		// for all layers except 0th which has no weights
-			for (int n = 0; n < Net_h[0]->layers[l].numNeurons; n++)	// for each neuron
-				for (int i = 0; i < Net_h[0]->layers[l - 1].numNeurons; i++) // for each weight
-					{
-					// Calculate average value
-					double avg = 0.0f;
-					for (int m = 0; m < M; ++m)		// for each multiplicity
-						avg += Net_h[m]->layers[l].neurons[n].weights[i + 1];
-					avg /= M;
-
-					// Overwrite all weights with average value
-					for (int m = 0; m < M; ++m)		// for each multiplicity
-						Net_h[m]->layers[l].neurons[n].weights[i + 1] = avg;
-					}
+		// ***** Forward propagation, error, and back-propagation of the whole batch
+		double mean_err = train_sets(enc, SetBatch, offsets, &X[0][0], &ideal[0][0]);
+		sum_report += mean_err;
 
 		// plot_W(Net);
 		// plot_W(Net);
@@ -313,13 +394,14 @@ int main(int argc, char **argv)
 			#define numTests 50
 			for (int j = 0; j < numTests; ++j)
 				{
-				// Create random K vector
-				for (int m = 0; m < M; ++m)
+				// Create a random set
+				int testOffsets[2] = {0, MaxSetSize};
+				for (int m = 0; m < MaxSetSize; ++m)
 					for (int i = 0; i < N; ++i)
 						X[m][i] = random01();
 				// plot_tester(K[0], K[1]);
 
-				ForwardPropMethod(Net_g, N, X[0]);
+				encode_sets(enc, 1, testOffsets, &X[0][0]);
 
 				// Desired value = K_star
 				double single_err = 0.0;
@@ -347,7 +429,7 @@ int main(int argc, char **argv)
 
 		if (l > 50 && (isnan(mean_err) || mean_err > 10.0))
 			{
-			re_randomize(Net_h[0], numLayers, neuronsPerLayer);
+			re_randomize(enc->h, numLayers, neuronsPerLayer);
 			sum_err1 = 0.0; sum_err2 = 0.0;
 			tail = 0;
 			for (int j = 0; j < num_errs; ++j) // clear errors to 0.0
@@ -370,10 +452,14 @@ int main(int argc, char **argv)
 			//	break;
 			}
 
-		if ((l % 10000) == 0) // display status periodically
+		if ((l % ReportSteps) == 0) // display status periodically
 			{
-			s += sprintf(s, "mean error=%e", mean_err);
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			s += sprintf(s, "mean error=%e, %.0f sets/sec", sum_report / ReportSteps,
+				ReportSteps * SetBatch / seconds);
 			printf("%s\n", status);
+			sum_report = 0.0;
+			start = chrono::steady_clock::now();
 			// plot_NN(Net);
 			// plot_W(Net);
 			// plot_LogErr(mean_err, ErrorThreshold);
@@ -391,7 +477,7 @@ int main(int argc, char **argv)
 			break;
 		else if (userKey == 3)			// Re-start with new random weights
 			{
-			re_randomize(Net_h[0], numLayers, neuronsPerLayer);
+			re_randomize(enc->h, numLayers, neuronsPerLayer);
 			sum_err1 = 0.0; sum_err2 = 0.0;
 			tail = 0;
 			for (int j = 0; j < num_errs; ++j) // clear errors to 0.0
@@ -417,7 +503,5 @@ int main(int argc, char **argv)
 	//	pause_graphics();
 	// else
 	//	quit_graphics();
-	free_NN(Net_g, neuronsPerLayer);
-	for (int m = 0; m < M; ++m)
-		free_NN(Net_h[m], neuronsPerLayer);
+	free_set_encoder(enc, neuronsPerLayer, neuronsPerLayer);
 	}
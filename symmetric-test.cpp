@@ -3,11 +3,13 @@
 #include <math.h>
 #include <stdbool.h>
 #include <random>
+#include <string>
+#include <chrono>
 #include "QNET.h"
 
 using namespace std;
 
-extern "C" QNET *create_QNN(int);
+extern "C" QNET *create_QNN(int, int);
 extern "C" void free_QNN(QNET *);
 extern "C" void forward_prop_quadratic(QNET *, double*);
 extern "C" void back_prop_quadratic(QNET *, double*);
@@ -75,6 +77,7 @@ extern "C" void re_randomize(QNET *);
 
 #define ForwardPropMethod	forward_prop_quadratic
 #define ErrorThreshold		0.02
+#define TestDim				4		// dimension of the layers
 
 extern "C" void symmetric_test()
 	{
@@ -82,12 +85,12 @@ extern "C" void symmetric_test()
 	// std::normal_distribution<double> distribution(0.0,0.2);
 
 	int numLayers = 3;						// must be at least 3
-	QNET *Net = create_QNN(numLayers);		// our NN for learning
+	QNET *Net = create_QNN(numLayers, TestDim);		// our NN for learning
 	LAYER lastLayer = Net->layers[numLayers - 1];
-	double errors[dim_V];
+	double errors[TestDim];
 
 	printf("test forward prop...\n");
-	double K[dim_V];
+	double K[TestDim];
 	printf("K ={ ");
 	for (int k = 0; k < 4; ++k)
 		{
@@ -159,7 +162,7 @@ extern "C" void symmetric_test()
 		s = status + sprintf(status, "[%05d] ", i);
 
 		// Create random K vector
-		for (int k = 0; k < dim_V; ++k)
+		for (int k = 0; k < TestDim; ++k)
 			K[k] = (rand() / (float) RAND_MAX);
 		// printf("*** K = <%lf, %lf>\n", K[0], K[1]);
 
@@ -176,7 +179,7 @@ extern "C" void symmetric_test()
 
 		// Desired value = K_star
 		double training_err = 0.0;
-		for (int k = 0; k < dim_V; ++k) // output has 4 components
+		for (int k = 0; k < TestDim; ++k) // output has 4 components
 			{
 			// double ideal = K[k];				/* identity function */
 			#define f2b(x) (x > 0.5f ? 1 : 0)	// convert float to binary
@@ -228,7 +231,7 @@ extern "C" void symmetric_test()
 			for (int j = 0; j < numTests; ++j)
 				{
 				// Create random K vector
-				for (int k = 0; k < dim_V; ++k)
+				for (int k = 0; k < TestDim; ++k)
 					K[k] = ((double) rand() / (double) RAND_MAX);
 				// plot_tester(K[0], K[1]);
 
@@ -236,7 +239,7 @@ extern "C" void symmetric_test()
 
 				// Desired value = K_star
 				double single_err = 0.0;
-				for (int k = 0; k < dim_V; ++k)
+				for (int k = 0; k < TestDim; ++k)
 					{
 					// double ideal = 1.0f - (0.5f - K[0]) * (0.5f - K[1]);
 					double ideal = (double) (f2b(K[0]) ^ f2b(K[1]));
@@ -332,7 +335,81 @@ extern "C" void symmetric_test()
 	free_QNN(Net);
 	}
 
-int main() {
+// **** Scaling test of the quadratic layers, from dim 4 to 16k.
+// Forward- and back-prop take O(dim) per layer, so the time per element should stay about
+// the same.  For the small dims, the outputs are checked against the full O(dim³) sum.
+
+// The full sum v_n = Σ_ij W_nij x_i x_j, with the 4 distinct weights
+static void naive_layer(LAYER &layer, int dim, NEURON *inputs, double v[])
+	{
+	for (int n = 0; n < dim; n++)
+		{
+		v[n] = 0.0;
+		for (int i = 0; i < dim; i++)
+			for (int j = 0; j < dim; j++)
+				{
+				double weight;
+				if (i == j)
+					weight = (n == i) ? layer.alpha : layer.beta;
+				else
+					weight = (n == i || n == j) ? layer.gamma : layer.delta;
+				v[n] += weight * inputs[i].output * inputs[j].output;
+				}
+		}
+	}
+
+extern "C" void quadratic_benchmark()
+	{
+	#define BenchLayers		3
+	#define MaxNaiveDim		64
+	printf("\n   dim      μs/step   ns/element   max |closed form - full sum|\n");
+	for (int dim = 4; dim <= 16384; dim *= 4)
+		{
+		QNET *Net = create_QNN(BenchLayers, dim);
+		double *K = new double[dim];
+		double *errors = new double[dim];
+		for (int k = 0; k < dim; ++k)
+			{
+			K[k] = rand() / (double) RAND_MAX / dim;	// keeps the outputs of the order of 1
+			errors[k] = 0.0;							// the weights do not change
+			}
+
+		int steps = 4000000 / dim + 10;
+		auto start = chrono::steady_clock::now();
+		for (int t = 0; t < steps; ++t)
+			{
+			forward_prop_quadratic(Net, K);
+			back_prop_quadratic(Net, errors);
+			}
+		double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / steps;
+
+		printf("%6d %12.2f %12.2f", dim, us, us * 1000.0 / dim);
+		if (dim <= MaxNaiveDim)
+			{
+			double *v = new double[dim];
+			double maxDiff = 0.0;
+			forward_prop_quadratic(Net, K);
+			for (int l = 1; l < BenchLayers; ++l)
+				{
+				naive_layer(Net->layers[l], dim, Net->layers[l - 1].neurons, v);
+				for (int n = 0; n < dim; ++n)
+					maxDiff = max(maxDiff, fabs(v[n] - Net->layers[l].neurons[n].output));
+				}
+			printf("   %.2e", maxDiff);
+			delete [] v;
+			}
+		printf("\n");
+
+		delete [] K;
+		delete [] errors;
+		free_QNN(Net);
+		}
+	}
+
+int main(int argc, char **argv) {
 	printf("\n\x1b[32m——`—,—{\x1b[31;1m@\x1b[0m\n");	// Genifer logo ——`—,—{@
-	symmetric_test();
+	if (argc > 1 && string(argv[1]) == "bench")
+		quadratic_benchmark();
+	else
+		symmetric_test();
 }
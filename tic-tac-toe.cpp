@@ -2,19 +2,42 @@
 
 #include <cstdlib>		// rand()
 #include <iostream>
-#include <fstream>
-#include <sstream>		// for converting double to string
 #include <list>
-#include <map>
+#include <vector>
+#include <functional>
+#include <chrono>
 #include <math.h>		// floor
 #include "tic-tac-toe.h"
 
 using namespace std;
 
+extern "C" // Functions from V-learning.c
+	{
+	void init_Vnet(void);
+	void load_Vnet(void);
+	void save_Vnet(char const *);
+	double get_V(int x[9]);
+	void get_V_batch(int n, int x[][9], double v[]);
+	void train_V(int x[9], double v);
+	double train_V_epoch(int n, double X[], double V[], int batchSize);
+	void learn_V(int x[9], int y[9]);
+
+	// functions from visualization.c
+	void beep();
+	}
+
+// ******** Functions from V-table.cpp
+extern void saveVToFile(string filename, std::list<State> &states, VTable &V);
+extern int loadVFromFile(string filename, std::list<State> &states, VTable &V);
+extern int loadValues(string name, std::list<State> &states, VTable &V);
+
+// ******** Functions from minimax.cpp
+extern double scoreMover(const char *name, int player, std::function<int ()> mover);
+
 State board;
 
-std::map<State, double, smaller> V1;		// V-value maps: board --> value
-std::map<State, double, smaller> V2;
+VTable V1;		// V-value maps: board --> value
+VTable V2;
 
 std::list<State> states1;					// What are these??
 std::list<State> states2;
@@ -24,49 +47,28 @@ int totalStates2 = 0;
 
 void initBoard()
 	{
-	for (int i = 0; i < 9; ++i)
-		board.x[i] = 0;
+	board = State();
 	}
 
-int hasWinner()
+// 1 or -1 = winner, -2 = draw, 0 = game still open
+int hasWinner(const State &s)
 	{
-	for (int player = -1; player < 2; player += 2) // player = -1 and 1
-		{
-		int tile = player;
-
-		// check horizontal
-		for (int i = 0; i < 3; ++i)
-			{
-			int j = i * 3;
-			if ((board.x[j] == tile) && (board.x[j + 1] == tile) && (board.x[j + 2] == tile))
-				return player;
-			}
-
-		// check vertical
-		for (int i = 0; i < 3; ++i)
-			{
-			if ((board.x[i] == tile) && (board.x[i + 3] == tile) && (board.x[i + 6] == tile))
-				return player;
-			}
-
-		// check backward diagonal
-		if ((board.x[0] == tile) && (board.x[4] == tile) && (board.x[8] == tile))
-			return player;
+	if (boardTables.win[s.O])
+		return -1;
+	if (boardTables.win[s.X])
+		return 1;
 
-		// check forward diagonal
-		if ((board.x[6] == tile) && (board.x[4] == tile) && (board.x[2] == tile))
-			return player;
-		}
+	if (s.blanks() != 0)
+		return 0;
 
-	// 0 is for game still open
-	for (int i = 0; i < 9; ++i)
-		if (board.x[i] == 0)
-			return 0;
-
-	// -2 is for draw match
 	return -2;
 	}
 
+int hasWinner()
+	{
+	return hasWinner(board);
+	}
+
 int switchPlayer(int player)
 	{
 	if (player == 1)
@@ -79,9 +81,9 @@ void printState(State _board)
 	{
 	for (int i = 0; i < 9; ++i)
 		{
-		if (_board.x[i] == 1)
+		if (_board.at(i) == 1)
 			cout << "X";
-		else if (_board.x[i] == -1)
+		else if (_board.at(i) == -1)
 			cout << "O";
 		else
 			cout << ".";
@@ -92,97 +94,109 @@ void printState(State _board)
 
 bool updateBoard(int player, int index)
 	{
-	if (board.x[index] == 0)
+	if (board.blanks() & (1 << index))
 		{
-		board.x[index] = player;
+		board.set(index, player);
 		return true;
 		}
 	return false;
 	}
 
-void getListOfBlankTiles(std::list<int> &blanks)
+// Returns the blank squares of the board as a bitmask;  the number of possible moves
+// is its popcount, and nthSquare() picks one of them.
+unsigned getListOfBlankTiles()
 	{
-	for (int i = 0; i < 9; ++i)
+	return board.blanks();
+	}
+
+// Generate all successor states of s, when player makes one move.
+// OUTPUT: moves = the squares played, next = the resulting states
+// Returns the number of legal moves.  The state s itself is not changed.
+int legalMoves(const State &s, int player, int moves[9], State next[9])
+	{
+	int n = 0;
+	for (unsigned blanks = s.blanks(); blanks != 0; blanks &= blanks - 1)
 		{
-		if (board.x[i] == 0)
-			blanks.push_front(i);
+		int i = __builtin_ctz(blanks);
+		moves[n] = i;
+		next[n] = s;
+		next[n].set(i, player);
+		++n;
 		}
+	return n;
 	}
 
-// INPUT: V-value map for player
-// OUTPUT: best move from this player's perspective
-int greedyMove(std::map<State, double, smaller> &V, int player)
+// Returns the move with the maximum value;  ties go to the highest square, as before.
+int argmaxMove(int n, int moves[9], double values[9])
 	{
-	double maxVal = 0.0;
+	double maxVal = -100.0; // set to -∞ initially
 	int bestMove = -1;
 
-	// get list of possible next moves
-	std::list<int> nextMoves;
-	getListOfBlankTiles(nextMoves);
-	// cout << "# next moves = " << to_string(nextMoves.size()) << "\n";
-
-	maxVal = -100.0; // set to -∞ initially
-
-	// For all possible next moves...
-	for (std::list<int>::iterator itr = nextMoves.begin(); itr != nextMoves.end(); ++itr)
-		{
-		int i = *itr;				// get the next move
-
-		board.x[i] = player;		// try this board move
-		// printState(board);
-		double v = V.at(board);		// V-value according to this player's values map
-		// cout << "Value = " << to_string(v) << "\n";
-
-		if (v > maxVal)
+	for (int m = n - 1; m >= 0; --m)
+		if (values[m] > maxVal)
 			{
-			bestMove = i;
-			maxVal = v;
+			bestMove = moves[m];
+			maxVal = values[m];
 			}
+	return bestMove;
+	}
 
-		board.x[i] = 0;				// reset, try next move
-		}
+// INPUT: V-value map for player
+// OUTPUT: best move from this player's perspective
+int greedyMove(VTable &V, int player)
+	{
+	// get list of possible next moves
+	int moves[9];
+	State next[9];
+	int n = legalMoves(board, player, moves, next);
+
+	// V-value according to this player's values map
+	double values[9];
+	for (int m = 0; m < n; ++m)
+		values[m] = V.at(next[m]);
 
 	// cout << "Made greedy move...\n";
-	return bestMove;
+	return argmaxMove(n, moves, values);
 	}
 
-// same as greedyMove, except it calls get_V()
+// same as greedyMove, except it scores all the moves with a single batched get_V()
 int computerMove(int player)
 	{
-	double maxVal = 0.0;
-	int bestMove = -1;
-
 	// get list of possible next moves
-	std::list<int> nextMoves;
-	getListOfBlankTiles(nextMoves);
-	// cout << "# next moves = " << to_string(nextMoves.size()) << "\n";
-
-	maxVal = -100.0; // set to -∞ initially
-
-	// For all possible next moves...
-	for (std::list<int>::iterator itr = nextMoves.begin(); itr != nextMoves.end(); ++itr)
+	int moves[9];
+	State next[9];
+	int n = legalMoves(board, player, moves, next);
+
+	// The V-net only knows canonical boards;  moves giving symmetric boards share 1 row
+	int x[9][9], row[9], rows = 0;
+	int ids[9];
+	for (int m = 0; m < n; ++m)
 		{
-		int i = *itr;
-
-		board.x[i] = player;
-		double v = get_V(board.x);
-		// cout << "Value = " << to_string(v) << "\n";
-
-		if (v > maxVal)
+		ids[m] = canonTable.id[stateIndex(next[m])];
+		row[m] = -1;
+		for (int m2 = 0; m2 < m; ++m2)
+			if (ids[m2] == ids[m])
+				row[m] = row[m2];
+		if (row[m] < 0)
 			{
-			bestMove = i;
-			maxVal = v;
+			Board b = canonical(next[m]).array();
+			for (int k = 0; k < 9; ++k)
+				x[rows][k] = b.x[k];
+			row[m] = rows++;
 			}
-
-		board.x[i] = 0;
 		}
 
+	double rowValues[9], values[9];
+	get_V_batch(rows, x, rowValues);
+	for (int m = 0; m < n; ++m)
+		values[m] = rowValues[row[m]];
+
 	// cout << "Made greedy move...\n";
-	return bestMove;
+	return argmaxMove(n, moves, values);
 	}
 
 // **** Is this update justified??
-void BellmanUpdate(State &s2, State &s, std::map<State, double, smaller> &V)
+void BellmanUpdate(State &s2, State &s, VTable &V)
 	{
 #define alpha	0.01
 
@@ -194,75 +208,12 @@ void BellmanUpdate(State &s2, State &s, std::map<State, double, smaller> &V)
 	V.at(s) += alpha * (V.at(s2) - V.at(s));
 	}
 
-void saveVToFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V)
-	{
-	ofstream file2(filename);
-
-	// file2 << "Size is " << to_string(states.size());
-	// file2 << "Size is " << to_string(V.size());
-	// file2 << "\nDon't know why... \n";
-
-	for (std::list<State>::iterator it = states.begin(); it != states.end(); ++it)
-		{
-		char state_string[9 * 2 + 1];
-		for (int i = 0; i < 9; ++i)
-			{
-			state_string[i * 2] = (*it).x[i] + '0';
-			state_string[i * 2 + 1] = ':';
-			}
-		state_string[17] = ' ';
-		state_string[18] = '\0';
-
-		std::ostringstream strs;
-		strs << V[*it];
-		string value_string = strs.str();
-
-		file2 << state_string << value_string << endl;
-		// file2 << value_string << "\n";
-		// file2 << state_string << "\n";
-		// file2 << "testing" << endl;
-		}
-	file2.close();
-	}
-
-int loadVFromFile(string filename, std::list<State> &states, std::map<State, double, smaller> &V)
+extern "C" int tic_tac_toe_test()
 	{
-	ifstream file1(filename);
-
-	string line;
-	State state;
-	int total = 0;
-	while (getline(file1, line))
-		{
-		// cout << line;
-		for (int i = 0; i < 9; ++i)
-			state.x[i] = line[i * 2] - '0';
-		states.push_front(state);
-		// printState(state);
-
-		double value = std::stod(line.substr(18));
-		// cout << "\t" << value << "\n";
-		V[state] = value;
-		++total;
-		}
-	file1.close();
-	return total;
-	}
-
-int tic_tac_toe_test()
-	{
-	extern void init_Vnet(void);
-	extern void load_Vnet(void);
-	extern void save_Vnet(char *);
-	extern double get_V(int x[9]);
-	extern void train_V(int x[9], double v);
-	extern void learn_V(int x[9], int y[9]);
-	extern void beep();
-
 	// Build states for RL player 1
 	cout << "Loading player 1's V values...\n";
 	states1.clear();
-	int totalStates1 = loadVFromFile("ttt1.dat", states1, V1);
+	int totalStates1 = loadValues("ttt1", states1, V1);
 	cout << "Total read: " << to_string(totalStates1) << "\n";
 
 	//*** Train player1's V network
@@ -281,103 +232,47 @@ int tic_tac_toe_test()
 	else
 		load_Vnet();
 
-	if (key == 'o')
-		{
-		for (int t = 0; t < 10000; ++t)
-			{
-			// For all states
-			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
-				{
-				State s = *itr;
-
-				double v = V1.at(s);
-
-				train_V(s.x, v);
-				}
-
-			double absError = 0.0; // sum of abs(error)
-			// Calculate error
-			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
-				{
-				State s = *itr;
-
-				double v = V1.at(s);
-				//cout << "v = " << to_string(v) << "\t";
-
-				double v2 = get_V(s.x);
-				//cout << "v2 = " << to_string(v2) << "\t";
-
-				double error = v - v2; // ideal - actual
-				//cout << "err = " << to_string(error) << "\n";
-
-				absError += fabs(error);
-				}
-			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / 8533.0);
-
-			if (isnan(absError))
-				{
-				init_Vnet();
-				t = 0;
-				}
-			}
-		cout << "\n\n";
-		save_Vnet("v.net");
-		}
-	else if (key == 't' || key == 'i')
+	if (key == 'o' || key == 't' || key == 'i')
 		{
-		for (int t = 0; t < 500; ++t)
+		// Pack the training boards and their target values into contiguous arrays:
+		// [o] = all states with their old V values, [t] = the end states with their results
+		vector<double> X, Y;
+		for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
 			{
-			// For all states
-			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
+			State s = *itr;
+			double v;
+			if (key == 'o')
+				v = V1.at(s);
+			else
 				{
-				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
-				double v;
-
-				if (result == -2)
+				int result = hasWinner(s);
+				if (result == 0)
+					continue;
+				else if (result == -2)
 					v = 0.5;
 				else if (result == -1)
 					v = 0.0;
-				else if (result == 1)
+				else
 					v = 1.0;
-
-				if (result != 0)
-					train_V(s.x, v);
 				}
 
-			double absError = 0.0; // sum of abs(error)
-			// Calculate error
-			for (std::list<State>::iterator itr = states1.begin(); itr != states1.end(); ++itr)
-				{
-				State s = *itr;
-
-				board = s;
-				int result = hasWinner();
-				double v;
-
-				double v2 = get_V(s.x);
-				//cout << "v2 = " << to_string(v2) << "\t";
-
-				if (result == -2)
-					v = 0.5;
-				else if (result == -1)
-					v = 0.0;
-				else if (result == 1)
-					v = 1.0;
-
-				double error = v - v2; // ideal - actual
-				//cout << "err = " << to_string(error) << "\n";
+			Board b = s.array();
+			X.insert(X.end(), b.x, b.x + 9);
+			Y.push_back(v);
+			}
 
-				if (result == 0)
-					error = 0.0;
+		#define VBatchSize	16
+		int epochs = (key == 'o') ? 10000 : 500;
+		double totalMs = 0.0;
+		for (int t = 0; t < epochs; ++t)
+			{
+			auto start = chrono::steady_clock::now();
+			double absError = train_V_epoch(Y.size(), X.data(), Y.data(), VBatchSize); // sum of abs(error)
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			totalMs += ms;
 
-				absError += fabs(error);
-				}
 			printf("(%05d) ", t);
-			printf("∑ abs err = %.1f (avg = %.3f)\r", absError, absError / 8533.0);
+			printf("∑ abs err = %.1f (avg = %.3f) %.3f ms/epoch\r", absError, absError / Y.size(), ms);
 
 			if (isnan(absError))
 				{
@@ -385,6 +280,7 @@ int tic_tac_toe_test()
 				t = 0;
 				}
 			}
+		printf("\nAverage %.3f ms/epoch over %zu boards", totalMs / epochs, Y.size());
 		cout << "\n\n";
 		save_Vnet("v.net");
 		}
@@ -392,7 +288,7 @@ int tic_tac_toe_test()
 	// Build states for RL player 1
 	cout << "\n\nLoading player -1...\n";
 	states2.clear();
-	int totalStates2 = loadVFromFile("ttt2.dat", states2, V2);
+	int totalStates2 = loadValues("ttt2", states2, V2);
 	cout << "Total read: " << to_string(totalStates2) << "\n";
 
 	#define totalGames 500000
@@ -419,9 +315,8 @@ int tic_tac_toe_test()
 
 		while (true) // Loop over 1 single game
 			{
-			std::list<int> nextMoves;
-			getListOfBlankTiles(nextMoves);
-			int countNextMoves = nextMoves.size();
+			unsigned nextMoves = getListOfBlankTiles();
+			int countNextMoves = __builtin_popcount(nextMoves);
 
 			// cout << "Move of player: " << to_string(player) << "\n";
 
@@ -436,9 +331,7 @@ int tic_tac_toe_test()
 					{
 					// generate random # within range of possible moves
 					int move = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
-					std::list<int>::iterator it = nextMoves.begin();
-					std::advance(it, move);
-					userMove = *it;
+					userMove = nthSquare(nextMoves, move);
 					//cout << "Exploring move = " << to_string(userMove) << "\n";
 					updateBoard(player, userMove);
 					prev_s1 = board;
@@ -463,9 +356,7 @@ int tic_tac_toe_test()
 					{
 					int move = (int) floor((rand() / (double) RAND_MAX) * countNextMoves);
 					//cout << "Exploring move = " << to_string(move) << "\n";
-					std::list<int>::iterator it = nextMoves.begin();
-					std::advance(it, move);
-					userMove = *it;
+					userMove = nthSquare(nextMoves, move);
 					updateBoard(player, userMove);
 					prev_s1 = board;
 					}
@@ -475,7 +366,7 @@ int tic_tac_toe_test()
 					//cout << "Computer move = " << to_string(userMove) << "\n";
 					updateBoard(player, userMove);
 					max_s1 = board;
-					learn_V(max_s1.x, prev_s1.x);
+					learn_V(canonical(max_s1).array().x, canonical(prev_s1).array().x);
 					prev_s1 = max_s1;
 					}
 				}
@@ -487,7 +378,7 @@ int tic_tac_toe_test()
 			if (won == -2) // draw
 				{
 				numDraws++;
-				train_V(board.x, 0.5);
+				train_V(canonical(board).array().x, 0.5);
 				// cout << "It's a draw !\n\n";
 				break;
 				}
@@ -499,7 +390,7 @@ int tic_tac_toe_test()
 					++numPlayer1Won;
 					max_s2 = board;
 					BellmanUpdate(max_s2, prev_s2, V2);
-					train_V(max_s2.x, 1.0);
+					train_V(canonical(max_s2).array().x, 1.0);
 					// cout << "V2(s) changed from " << to_string(V2[prev_s2]);
 					// cout << "to " << to_string(V2[prev_s2]);
 					}
@@ -507,8 +398,8 @@ int tic_tac_toe_test()
 					{
 					++numPlayer_1Won;
 					max_s1 = board;
-					train_V(max_s1.x, 0.0);
-					learn_V(max_s1.x, prev_s1.x);
+					train_V(canonical(max_s1).array().x, 0.0);
+					learn_V(canonical(max_s1).array().x, canonical(prev_s1).array().x);
 					}
 
 				// cout << "Winner is: player " << to_string(player) << "\n\n";
@@ -539,6 +430,10 @@ int tic_tac_toe_test()
 	printf("Player -1 Wins %d (%2.1f%%)\n", numPlayer_1Won, ((float) numPlayer_1Won) / totalGames * 100.0);
 	printf("         Draws %d (%2.1f%%)\n", numDraws, ((float) numDraws) / totalGames * 100.0);
 
+	// Score the players against optimal play
+	scoreMover("V-net (computerMove)", 1, []() { return computerMove(1); });
+	scoreMover("V2 table (greedyMove)", -1, []() { return greedyMove(V2, -1); });
+
 	beep();
 	return 0;
 	}
@@ -12,20 +12,179 @@
 extern "C" {
 #endif
 
-	struct State {
-		int x[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+	// **** Bitboard tables, over all 512 subsets (9-bit masks) of the squares
+	//	0 1 2
+	//	3 4 5
+	//	6 7 8
+	struct BoardTables {
+		bool win[512];			// does the mask contain a line of 3?
+		int base3[512];			// ∑ 3^i for the squares i in the mask
+
+		constexpr BoardTables() : win(), base3() {
+			const int lines[8] = {0007, 0070, 0700, 0111, 0222, 0444, 0421, 0124};
+			for (int m = 0; m < 512; ++m) {
+				for (int l = 0; l < 8; ++l)
+					if ((m & lines[l]) == lines[l])
+						win[m] = true;
+				for (int i = 8; i >= 0; --i)
+					base3[m] = base3[m] * 3 + ((m >> i) & 1);
+			}
+		}
+	};
+
+	inline constexpr BoardTables boardTables;
+
+	// Unpacked board, 9 numbers ∈ {-1,0,1}, as needed by the NN interfaces
+	struct Board {
+		int x[9];
 	};
 
-	// establish ordering among board states
-	struct smaller {
+	// Board state as 2 bitmasks:  squares taken by player 1 (X) and by player -1 (O)
+	struct State {
+		unsigned short X = 0;
+		unsigned short O = 0;
+
+		// square i ∈ {-1,0,1}
+		int at(int i) const {
+			return ((X >> i) & 1) - ((O >> i) & 1);
+		}
+
+		void set(int i, int player) {
+			if (player == 1)
+				X |= 1 << i;
+			else
+				O |= 1 << i;
+		}
+
+		unsigned blanks() const {
+			return ~(X | O) & 0777;
+		}
+
+		Board array() const {
+			Board b;
+			for (int i = 0; i < 9; ++i)
+				b.x[i] = at(i);
+			return b;
+		}
 
-		bool operator()(const State s1, const State s2) const {
+		static State fromArray(const int x[9]) {
+			State s;
 			for (int i = 0; i < 9; ++i)
-				if (s1.x[i] > s2.x[i])
-					return true;
-				else if (s1.x[i] < s2.x[i])
-					return false;
-			return false;
+				if (x[i] != 0)
+					s.set(i, x[i]);
+			return s;
+		}
+	};
+
+	// Returns the square of the n-th (from 0) lowest set bit of mask
+	inline int nthSquare(unsigned mask, int n) {
+		while (n-- > 0)
+			mask &= mask - 1;
+		return __builtin_ctz(mask);
+	}
+
+	// **** D4 symmetries of the board:  4 rotations × reflection
+	// Board g(s) has on square i what s has on square perm[g][i];  so a square j of
+	// the transformed board is the square perm[g][j] of the real board.
+	#define NumSyms		8
+
+	struct SymTables {
+		signed char perm[NumSyms][9];
+		unsigned short mask[NumSyms][512];	// 9-bit mask --> transformed mask
+
+		constexpr SymTables() : perm{
+				{0, 1, 2, 3, 4, 5, 6, 7, 8},	// identity
+				{6, 3, 0, 7, 4, 1, 8, 5, 2},	// rotate 90°
+				{8, 7, 6, 5, 4, 3, 2, 1, 0},	// rotate 180°
+				{2, 5, 8, 1, 4, 7, 0, 3, 6},	// rotate 270°
+				{2, 1, 0, 5, 4, 3, 8, 7, 6},	// mirror left-right
+				{6, 7, 8, 3, 4, 5, 0, 1, 2},	// mirror top-bottom
+				{0, 3, 6, 1, 4, 7, 2, 5, 8},	// transpose
+				{8, 5, 2, 7, 4, 1, 6, 3, 0}},	// anti-transpose
+				mask() {
+			for (int g = 0; g < NumSyms; ++g)
+				for (int m = 0; m < 512; ++m)
+					for (int i = 0; i < 9; ++i)
+						mask[g][m] |= ((m >> perm[g][i]) & 1) << i;
+		}
+	};
+
+	inline constexpr SymTables symTables;
+
+	inline State transform(const State &s, int g) {
+		State t;
+		t.X = symTables.mask[g][s.X];
+		t.O = symTables.mask[g][s.O];
+		return t;
+	}
+
+	// **** Value table:  board --> value
+	// Every board is 9 squares ∈ {-1,0,1}, so the boards have a perfect hash into
+	// 3^9 = 19683 entries, the base-3 number with digits (x[i] + 1).  The dense table
+	// (~150 KB) replaces the std::map<State, double> and its lexicographic compares.
+	#define NumStates	19683		// 3^9
+
+	// ∑ (x[i] + 1) 3^i = ∑ 3^i + ∑_X 3^i - ∑_O 3^i
+	inline int stateIndex(const State &s) {
+		return (NumStates - 1) / 2 + boardTables.base3[s.X] - boardTables.base3[s.O];
+	}
+
+	// The canonical representative of s is its image with the lowest stateIndex.
+	// OUTPUT: g = the symmetry that takes s to it
+	inline State canonical(const State &s, int *g = nullptr) {
+		State best = s;
+		int bestIndex = stateIndex(s), bestG = 0;
+		for (int h = 1; h < NumSyms; ++h) {
+			State t = transform(s, h);
+			int index = stateIndex(t);
+			if (index < bestIndex) {
+				best = t;
+				bestIndex = index;
+				bestG = h;
+			}
+		}
+		if (g != nullptr)
+			*g = bestG;
+		return best;
+	}
+
+	// All distinct images of s under the symmetries, returns their number
+	inline int orbit(const State &s, State images[NumSyms]) {
+		int n = 0;
+		for (int g = 0; g < NumSyms; ++g) {
+			State t = transform(s, g);
+			bool seen = false;
+			for (int k = 0; k < n; ++k)
+				if (images[k].X == t.X && images[k].O == t.O)
+					seen = true;
+			if (!seen)
+				images[n++] = t;
+		}
+		return n;
+	}
+
+	// Boards that are rotations / reflections of each other share the same value, so
+	// the value tables only store the symmetry classes (Burnside:  2862 classes out of
+	// 3^9 boards), numbered by canonTable.id[stateIndex(s)].  Defined in V-table.cpp.
+	#define NumCanon	2862
+
+	struct CanonTable {
+		unsigned short id[NumStates];
+		State board[NumCanon];		// class --> its canonical board
+		CanonTable();
+	};
+
+	extern CanonTable canonTable;
+
+	struct VTable {
+		double v[NumCanon] = {};	// boards never seen have value 0
+
+		double &operator[](const State &s) {
+			return v[canonTable.id[stateIndex(s)]];
+		}
+
+		double &at(const State &s) {
+			return v[canonTable.id[stateIndex(s)]];
 		}
 	};
 
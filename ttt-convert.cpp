@@ -0,0 +1,49 @@
+// Convert tic-tac-toe V-value files from the text format (name.dat) to the binary
+// format (name.vtb) read by loadValues().
+// Usage:  ttt-convert [name ...]		(default:  ttt1 ttt2)
+
+#include <iostream>
+#include <list>
+#include <string>
+#include <ctime>
+#include "tic-tac-toe.h"
+
+using namespace std;
+
+extern int loadVFromFile(string filename, std::list<State> &states, VTable &V);
+extern bool saveVTable(string filename, std::list<State> &states, VTable &V);
+extern int loadVTable(string filename, std::list<State> &states, VTable &V);
+
+VTable V;
+
+int main(int argc, char *argv[])
+	{
+	list<string> names;
+	for (int i = 1; i < argc; ++i)
+		names.push_back(argv[i]);
+	if (names.empty())
+		names = {"ttt1", "ttt2"};
+
+	for (string name : names)
+		{
+		std::list<State> states;
+		int total = loadVFromFile(name + ".dat", states, V);
+		if (total == 0)
+			{
+			cerr << name << ".dat:  no states read\n";
+			return 1;
+			}
+		if (!saveVTable(name + ".vtb", states, V))
+			return 1;
+
+		// Time the binary load, for comparison with the text parse
+		clock_t start = clock();
+		states.clear();
+		int total2 = loadVTable(name + ".vtb", states, V);
+		double t = (clock() - start) / (double) CLOCKS_PER_SEC;
+
+		cout << name << ".dat --> " << name << ".vtb:  " << total << " canonical states";
+		cout << " (reloaded " << total2 << " in " << t * 1e6 << " μs)\n";
+		}
+	return 0;
+	}